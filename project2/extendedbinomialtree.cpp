@@ -138,8 +138,9 @@ namespace QuantLib {
         Real up = 0.5 * r * q * (q + 1 + std::sqrt(q * q + 2 * q - 3));
         Real down = 0.5 * r * q * (q + 1 - std::sqrt(q * q + 2 * q - 3));
 
-        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index)))
-            * std::pow(up, Real(index));
+        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index))
+                                    + width_)
+            * std::pow(up, Real(index)-width_) + dividendAdjustment(i);
     }
 
     Real ExtendedTian_2::probability(Size i, Size, Size branch) const {
@@ -193,8 +194,9 @@ namespace QuantLib {
         Real up = ermqdt * pdash / pu;
         Real down = (ermqdt - pu * up) / (1.0 - pu);
 
-        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index)))
-            * std::pow(up, Real(index));
+        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index))
+                                    + width_)
+            * std::pow(up, Real(index)-width_) + dividendAdjustment(i);
     }
 
     Real ExtendedLeisenReimer_2::probability(Size i, Size, Size branch) const {
@@ -265,8 +267,9 @@ namespace QuantLib {
         Real up = ermqdt * pdash / pu;
         Real down = (ermqdt - pu * up) / (1.0 - pu);
 
-        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index)))
-            * std::pow(up, Real(index));
+        return x0_ * std::pow(down, Real(BigInteger(i)-BigInteger(index))
+                                    + width_)
+            * std::pow(up, Real(index)-width_) + dividendAdjustment(i);
     }
 
     Real ExtendedJoshi4_2::probability(Size i, Size, Size branch) const {
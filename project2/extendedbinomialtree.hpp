@@ -28,7 +28,9 @@
 #define extended_binomial_tree_hpp
 
 #include <ql/methods/lattices/tree.hpp>
+#include <ql/math/array.hpp>
 #include <ql/instruments/dividendschedule.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
 #include <ql/stochasticprocess.hpp>
 
 namespace QuantLib {
@@ -39,29 +41,108 @@ namespace QuantLib {
     class ExtendedBinomialTree_2 : public Tree<T> {
       public:
         enum Branches { branches = 2 };
+        //! tree parameters change from slice to slice
+        enum Parameters { constantParameters = 0 };
         ExtendedBinomialTree_2(
                         const boost::shared_ptr<StochasticProcess1D>& process,
                         Time end,
                         Size steps)
-        : Tree<T>(steps+1), treeProcess_(process) {
+        : Tree<T>(steps+1), width_(0), treeProcess_(process) {
             x0_ = process->x0();
             dt_ = end/steps;
             driftPerStep_ = process->drift(0.0, x0_) * dt_;
         }
         Size size(Size i) const {
-            return i+1;
+            return i+2*width_+1;
         }
         Size descendant(Size, Size index, Size branch) const {
             return index + branch;
         }
+        //! escrowed discrete dividends
+        /*! The tree is assumed to be built on a Black-Scholes process
+            whose spot is net of the present value of the dividends
+            paid up to its end.  The present value at each slice of
+            the dividends still to be paid is precomputed here and
+            added back to the node prices, so that the tree stays
+            recombining; each amount is discounted from its date to
+            the time of the slice on the risk-free curve of the
+            process.  Dividends paid at or before the start of the
+            tree, or after its end, are ignored.
+        */
+        void setDividends(const DividendSchedule& dividends) {
+            boost::shared_ptr<GeneralizedBlackScholesProcess> process =
+                boost::dynamic_pointer_cast<GeneralizedBlackScholesProcess>(
+                                                              treeProcess_);
+            QL_REQUIRE(process, "Black-Scholes process required");
+            const Handle<YieldTermStructure>& riskFreeRate =
+                process->riskFreeRate();
+            Time end = (this->columns()-1)*dt_;
+            dividendAdjustment_ = std::vector<Real>(this->columns(), 0.0);
+            for (Size k=0; k<dividends.size(); ++k) {
+                Time paymentTime = process->time(dividends[k]->date());
+                if (paymentTime <= 0.0 || paymentTime > end)
+                    continue;
+                Real amount = dividends[k]->amount() *
+                    riskFreeRate->discount(paymentTime);
+                for (Size i=0; i<this->columns() && i*dt_ < paymentTime; ++i)
+                    dividendAdjustment_[i] +=
+                        amount/riskFreeRate->discount(i*dt_);
+            }
+        }
+        //! present value at slice i of the dividends paid after it
+        Real dividendAdjustment(Size i) const {
+            return dividendAdjustment_.empty() ? 0.0 : dividendAdjustment_[i];
+        }
+        //! widened initial slice
+        /*! By default the tree has a single node at t=0.  With m > 0
+            it carries 2m+1 of them, centered on x0 at node m, and
+            each slice i has i+2m+1 nodes; the parameters of each
+            step are still the ones at its own time.  Rolling back
+            to t=0 then gives the option values at 2m+1 spot levels,
+            from which greeks() extracts delta and gamma without a
+            second rollback.
+        */
+        void setInitialWidth(Size m) {
+            width_ = m;
+        }
+        //! nodes on each side of x0 at t=0
+        Size initialWidth() const { return width_; }
+        //! value, delta and gamma from the values at t=0
+        /*! \c values must hold the option values on the initial
+            slice of a tree with at least one node on each side of
+            x0; delta and gamma are the derivatives of the parabola
+            through the middle three nodes.
+        */
+        void greeks(const Array& values,
+                    Real& value, Real& delta, Real& gamma) const {
+            QL_REQUIRE(width_ >= 1,
+                       "widened initial slice required for greeks");
+            QL_REQUIRE(values.size() == size(0),
+                       "wrong number of initial values ("
+                       << values.size() << ", " << size(0)
+                       << " required)");
+            Size m = width_;
+            Real s0d = this->impl().underlying(0, m-1);
+            Real s0m = this->impl().underlying(0, m);
+            Real s0u = this->impl().underlying(0, m+1);
+            Real h1 = s0m - s0d;
+            Real h2 = s0u - s0m;
+            Real f0 = values[m-1], f1 = values[m], f2 = values[m+1];
+            value = f1;
+            delta = (-h2/(h1*(h1+h2)))*f0 - ((h1-h2)/(h1*h2))*f1
+                  + (h1/(h2*(h1+h2)))*f2;
+            gamma = 2*(h2*f0 - (h1+h2)*f1 + h1*f2)/((h1*h2)*(h1+h2));
+        }
       protected:
         //time dependent drift per step
         Real driftStep(Time driftTime) const {
             return this->treeProcess_->drift(driftTime, x0_) * dt_;
         }
 
+        Size width_;
         Real x0_, driftPerStep_;
         Time dt_;
+        std::vector<Real> dividendAdjustment_;
 
       protected:
         boost::shared_ptr<StochasticProcess1D> treeProcess_;
@@ -83,9 +164,11 @@ namespace QuantLib {
 
         Real underlying(Size i, Size index) const {
             Time stepTime = i*this->dt_;
-            BigInteger j = 2*BigInteger(index) - BigInteger(i);
+            BigInteger j = 2*BigInteger(index) - BigInteger(i)
+                - 2*BigInteger(this->width_);
             // exploiting the forward value tree centering
-            return this->x0_*std::exp(i*this->driftStep(stepTime) + j*this->upStep(stepTime));
+            return this->x0_*std::exp(i*this->driftStep(stepTime) + j*this->upStep(stepTime))
+                + this->dividendAdjustment(i);
         }
 
         Real probability(Size, Size, Size) const { return 0.5; }
@@ -110,9 +193,11 @@ namespace QuantLib {
 
         Real underlying(Size i, Size index) const {
             Time stepTime = i*this->dt_;
-            BigInteger j = 2*BigInteger(index) - BigInteger(i);
+            BigInteger j = 2*BigInteger(index) - BigInteger(i)
+                - 2*BigInteger(this->width_);
             // exploiting equal jump and the x0_ tree centering
-            return this->x0_*std::exp(j*this->dxStep(stepTime));
+            return this->x0_*std::exp(j*this->dxStep(stepTime))
+                + this->dividendAdjustment(i);
         }
 
         Real probability(Size i, Size, Size branch) const {
@@ -1,7 +1,18 @@
 
 #include "extendedbinomialtree.hpp"
+#include <ql/cashflows/dividend.hpp>
 #include <ql/pricingengines/vanilla/binomialengine.hpp>
 #include <ql/experimental/lattices/extendedbinomialtree.hpp>
+#include <ql/pricingengines/vanilla/discretizedvanillaoption.hpp>
+#include <ql/methods/lattices/bsmlattice.hpp>
+#include <ql/instruments/vanillaoption.hpp>
+#include <ql/exercise.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/quotes/simplequote.hpp>
+#include <ql/termstructures/yield/flatforward.hpp>
+#include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
+#include <ql/time/calendars/target.hpp>
+#include <ql/time/daycounters/actual365fixed.hpp>
 #include <iostream>
 
 using namespace QuantLib;
@@ -10,7 +21,103 @@ int main() {
 
     try {
 
-        // add your code here
+        Calendar calendar = TARGET();
+        Date todaysDate(15, May, 1998);
+        Settings::instance().evaluationDate() = todaysDate;
+        Date maturity(17, May, 1999);
+        DayCounter dayCounter = Actual365Fixed();
+
+        Handle<Quote> underlyingH(
+            boost::shared_ptr<Quote>(new SimpleQuote(36.0)));
+        Handle<YieldTermStructure> flatTermStructure(
+            boost::shared_ptr<YieldTermStructure>(
+                new FlatForward(todaysDate, 0.06, dayCounter)));
+        Handle<YieldTermStructure> flatDividendTS(
+            boost::shared_ptr<YieldTermStructure>(
+                new FlatForward(todaysDate, 0.00, dayCounter)));
+        Handle<BlackVolTermStructure> flatVolTS(
+            boost::shared_ptr<BlackVolTermStructure>(
+                new BlackConstantVol(todaysDate, calendar, 0.20,
+                                     dayCounter)));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess(
+            new BlackScholesMertonProcess(underlyingH, flatDividendTS,
+                                          flatTermStructure, flatVolTS));
+
+        boost::shared_ptr<StrikedTypePayoff> payoff(
+            new PlainVanillaPayoff(Option::Put, 40.0));
+        boost::shared_ptr<Exercise> americanExercise(
+            new AmericanExercise(todaysDate, maturity));
+        VanillaOption americanOption(payoff, americanExercise);
+
+        Size timeSteps = 801;
+
+        // library engine: the greeks need the values at the third slice
+        americanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
+            new BinomialVanillaEngine<ExtendedCoxRossRubinstein>(bsmProcess,
+                                                                 timeSteps)));
+        std::cout << "BinomialVanillaEngine: "
+                  << americanOption.NPV() << ", Delta: "
+                  << americanOption.delta() << ", Gamma: "
+                  << americanOption.gamma() << std::endl;
+
+        // widened tree: price, delta and gamma at t=0 from one rollback
+        Time end = bsmProcess->time(maturity);
+        boost::shared_ptr<ExtendedCoxRossRubinstein_2> tree(
+            new ExtendedCoxRossRubinstein_2(bsmProcess, end, timeSteps,
+                                            payoff->strike()));
+        tree->setInitialWidth(1);
+        Rate r = flatTermStructure->zeroRate(end, Continuous);
+        boost::shared_ptr<BlackScholesLattice<ExtendedCoxRossRubinstein_2> >
+            lattice(new BlackScholesLattice<ExtendedCoxRossRubinstein_2>(
+                                                  tree, r, end, timeSteps));
+
+        VanillaOption::arguments arguments;
+        americanOption.setupArguments(&arguments);
+        TimeGrid grid(end, timeSteps);
+        DiscretizedVanillaOption option(arguments, *bsmProcess, grid);
+        option.initialize(lattice, end);
+        option.rollback(0.0);
+
+        Real value, delta, gamma;
+        tree->greeks(option.values(), value, delta, gamma);
+        std::cout << "Widened tree: " << value << ", Delta: " << delta
+                  << ", Gamma: " << gamma << std::endl;
+
+        // escrowed dividends: the tree is built on the spot net of the
+        // present value of the dividends, which is added back to the
+        // node prices
+        DividendSchedule dividends;
+        dividends.push_back(boost::shared_ptr<Dividend>(
+            new FixedDividend(1.0, Date(16, Nov, 1998))));
+        Real escrowedSpot = underlyingH->value();
+        for (Size k=0; k<dividends.size(); ++k)
+            escrowedSpot -= dividends[k]->amount() *
+                flatTermStructure->discount(dividends[k]->date());
+        boost::shared_ptr<BlackScholesMertonProcess> escrowedProcess(
+            new BlackScholesMertonProcess(
+                Handle<Quote>(
+                    boost::shared_ptr<Quote>(new SimpleQuote(escrowedSpot))),
+                flatDividendTS, flatTermStructure, flatVolTS));
+        boost::shared_ptr<ExtendedCoxRossRubinstein_2> dividendTree(
+            new ExtendedCoxRossRubinstein_2(escrowedProcess, end, timeSteps,
+                                            payoff->strike()));
+        dividendTree->setInitialWidth(1);
+        dividendTree->setDividends(dividends);
+        boost::shared_ptr<BlackScholesLattice<ExtendedCoxRossRubinstein_2> >
+            dividendLattice(new BlackScholesLattice<ExtendedCoxRossRubinstein_2>(
+                                          dividendTree, r, end, timeSteps));
+
+        DiscretizedVanillaOption dividendOption(arguments, *escrowedProcess,
+                                                grid);
+        dividendOption.initialize(dividendLattice, end);
+        dividendOption.rollback(0.0);
+
+        dividendTree->greeks(dividendOption.values(), value, delta, gamma);
+        std::cout << "Widened tree, dividend of "
+                  << dividends[0]->amount() << " on "
+                  << dividends[0]->date() << ": " << value
+                  << ", Delta: " << delta << ", Gamma: " << gamma
+                  << std::endl;
 
         return 0;
 
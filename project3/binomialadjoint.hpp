@@ -0,0 +1,606 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialadjoint.hpp
+    \brief Adjoint sensitivities of vanilla options on binomial trees
+*/
+
+#ifndef binomial_adjoint_hpp
+#define binomial_adjoint_hpp
+
+#include "binomialtree.hpp"
+#include "binomialrollback.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        /* Number carrying its derivatives along the market inputs
+           (spot, risk-free rate, dividend yield, volatility, strike
+           and maturity.)  It is only used on the few operations
+           building the tree parameters, where forward propagation
+           costs next to nothing. */
+        class BinomialDual_2 {
+          public:
+            enum Input { Spot, RiskFreeRate, DividendYield, Volatility,
+                         Strike, Maturity, Inputs };
+            BinomialDual_2(Real value = 0.0) : value_(value) {
+                std::fill(d_, d_+Inputs, 0.0);
+            }
+            BinomialDual_2(Real value, Input input) : value_(value) {
+                std::fill(d_, d_+Inputs, 0.0);
+                d_[input] = 1.0;
+            }
+            Real value() const { return value_; }
+            Real derivative(Size input) const { return d_[input]; }
+            Real& derivative(Size input) { return d_[input]; }
+            // f(x) given f and f' at x
+            BinomialDual_2 apply(Real f, Real df) const {
+                BinomialDual_2 y(f);
+                for (Size k=0; k<Inputs; ++k)
+                    y.d_[k] = df*d_[k];
+                return y;
+            }
+          private:
+            Real value_;
+            Real d_[Inputs];
+        };
+
+        inline BinomialDual_2 operator+(const BinomialDual_2& x,
+                                        const BinomialDual_2& y) {
+            BinomialDual_2 z(x.value() + y.value());
+            for (Size k=0; k<BinomialDual_2::Inputs; ++k)
+                z.derivative(k) = x.derivative(k) + y.derivative(k);
+            return z;
+        }
+
+        inline BinomialDual_2 operator-(const BinomialDual_2& x,
+                                        const BinomialDual_2& y) {
+            BinomialDual_2 z(x.value() - y.value());
+            for (Size k=0; k<BinomialDual_2::Inputs; ++k)
+                z.derivative(k) = x.derivative(k) - y.derivative(k);
+            return z;
+        }
+
+        inline BinomialDual_2 operator-(const BinomialDual_2& x) {
+            return x.apply(-x.value(), -1.0);
+        }
+
+        inline BinomialDual_2 operator*(const BinomialDual_2& x,
+                                        const BinomialDual_2& y) {
+            BinomialDual_2 z(x.value()*y.value());
+            for (Size k=0; k<BinomialDual_2::Inputs; ++k)
+                z.derivative(k) = x.derivative(k)*y.value()
+                                + x.value()*y.derivative(k);
+            return z;
+        }
+
+        inline BinomialDual_2 operator/(const BinomialDual_2& x,
+                                        const BinomialDual_2& y) {
+            Real q = x.value()/y.value();
+            BinomialDual_2 z(q);
+            for (Size k=0; k<BinomialDual_2::Inputs; ++k)
+                z.derivative(k) =
+                    (x.derivative(k) - q*y.derivative(k))/y.value();
+            return z;
+        }
+
+        inline BinomialDual_2 exp(const BinomialDual_2& x) {
+            Real e = std::exp(x.value());
+            return x.apply(e, e);
+        }
+
+        inline BinomialDual_2 log(const BinomialDual_2& x) {
+            return x.apply(std::log(x.value()), 1.0/x.value());
+        }
+
+        inline BinomialDual_2 sqrt(const BinomialDual_2& x) {
+            Real s = std::sqrt(x.value());
+            return x.apply(s, 0.5/s);
+        }
+
+        inline Real binomialValue(Real x) { return x; }
+        inline Real binomialValue(const BinomialDual_2& x) {
+            return x.value();
+        }
+
+        // same as PeizerPrattMethod2Inversion
+        template <class R>
+        R binomialPeizerPratt(const R& z, Size n) {
+            using std::exp;
+            using std::sqrt;
+            R x = z/R(n+1.0/3.0+0.1/(n+1.0));
+            R result = exp(-(x*x)*R(n+1.0/6.0));
+            R root = sqrt(R(0.25)*(R(1.0)-result));
+            return binomialValue(z) > 0.0 ? R(0.5) + root : R(0.5) - root;
+        }
+
+    }
+
+
+    //! Parameters of a constant-parameter tree as functions of the market
+    /*! Specializations repeat the computations of the constructor of
+        each tree on generic numbers, so that they can be carried out
+        with derivatives.  compute() takes the spot x0 on which the
+        tree is built, the drift and variance of the log-price over
+        a step and the strike, and returns the up probability and the
+        coefficients of the (dividend-free) node prices
+        \f[
+            \log S_{i,j} = \log x_0 + a + b i + c j
+        \f]
+        on a tree with three initial nodes; on a tree with 2m+1 of
+        them, the constant term is m a.
+        steps() returns the number of steps of the tree built for
+        the given one.
+    */
+    template <class T>
+    struct BinomialTreeParameters_2;
+
+    template <>
+    struct BinomialTreeParameters_2<CoxRossRubinstein_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R&, const R& drift, const R& variance,
+                            Size, const R&, R& pu, R& a, R& b, R& c) {
+            using std::sqrt;
+            R dx = sqrt(variance);
+            pu = R(0.5) + R(0.5)*drift/dx;
+            a = R(-2.0)*dx;
+            b = -dx;
+            c = R(2.0)*dx;
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<JarrowRudd_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R&, const R& drift, const R& variance,
+                            Size, const R&, R& pu, R& a, R& b, R& c) {
+            using std::sqrt;
+            R up = sqrt(variance);
+            pu = R(0.5);
+            a = R(-2.0)*up;
+            b = drift - up;
+            c = R(2.0)*up;
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<AdditiveEQPBinomialTree_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R&, const R& drift, const R& variance,
+                            Size, const R&, R& pu, R& a, R& b, R& c) {
+            using std::sqrt;
+            R up = R(-0.5)*drift + R(0.5)*
+                sqrt(R(4.0)*variance - R(3.0)*drift*drift);
+            pu = R(0.5);
+            a = R(-2.0)*up;
+            b = drift - up;
+            c = R(2.0)*up;
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<Trigeorgis_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R&, const R& drift, const R& variance,
+                            Size, const R&, R& pu, R& a, R& b, R& c) {
+            using std::sqrt;
+            R dx = sqrt(variance + drift*drift);
+            pu = R(0.5) + R(0.5)*drift/dx;
+            a = R(-2.0)*dx;
+            b = -dx;
+            c = R(2.0)*dx;
+        }
+    };
+
+    namespace detail {
+
+        // coefficients of trees with explicit up and down factors,
+        // whose prices are x0*down^(i-j+1)*up^(j-1)
+        template <class R>
+        void binomialUpDownCoefficients(const R& up, const R& down,
+                                        R& a, R& b, R& c) {
+            using std::log;
+            R logUp = log(up), logDown = log(down);
+            a = logDown - logUp;
+            b = logDown;
+            c = logUp - logDown;
+        }
+
+    }
+
+    template <>
+    struct BinomialTreeParameters_2<Tian_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R&, const R& drift, const R& variance,
+                            Size, const R&, R& pu, R& a, R& b, R& c) {
+            using std::exp;
+            using std::sqrt;
+            R q = exp(variance);
+            R r = exp(drift)*sqrt(q);
+            R root = sqrt(q*q + R(2.0)*q - R(3.0));
+            R up = R(0.5)*r*q*(q + R(1.0) + root);
+            R down = R(0.5)*r*q*(q + R(1.0) - root);
+            pu = (r - down)/(up - down);
+            detail::binomialUpDownCoefficients(up, down, a, b, c);
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<LeisenReimer_2> {
+        static Size steps(Size steps) { return steps%2 ? steps : steps+1; }
+        template <class R>
+        static void compute(const R& x0, const R& drift, const R& variance,
+                            Size steps, const R& strike,
+                            R& pu, R& a, R& b, R& c) {
+            using std::exp;
+            using std::log;
+            using std::sqrt;
+            R totalVariance = variance*R(Real(steps));
+            R ermqdt = exp(drift + R(0.5)*variance);
+            R d2 = (log(x0/strike) + drift*R(Real(steps)))
+                /sqrt(totalVariance);
+            pu = detail::binomialPeizerPratt(d2, steps);
+            R pdash = detail::binomialPeizerPratt(d2 + sqrt(totalVariance),
+                                                  steps);
+            R up = ermqdt*pdash/pu;
+            R down = (ermqdt - pu*up)/(R(1.0) - pu);
+            detail::binomialUpDownCoefficients(up, down, a, b, c);
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<StrikeAligned_2> {
+        static Size steps(Size steps) { return steps; }
+        template <class R>
+        static void compute(const R& x0, const R& drift, const R& variance,
+                            Size steps, const R& strike,
+                            R& pu, R& a, R& b, R& c) {
+            using std::exp;
+            using std::log;
+            using std::sqrt;
+            R growth = exp(drift + R(0.5)*variance);
+            R logStrike = log(strike/x0);
+            R dx = sqrt(variance);
+            // the aligned node does not move under small changes
+            Real upMoves = std::floor(
+                (detail::binomialValue(logStrike)
+                 + steps*detail::binomialValue(dx))
+                /(2.0*detail::binomialValue(dx)) + 0.5);
+            bool aligned = (upMoves >= 0.0 && upMoves <= Real(steps));
+            R up, down;
+            for (Size k=0; k<3; ++k) {
+                R tilt = aligned ?
+                    (logStrike - R(2.0*upMoves - steps)*dx)/R(Real(steps)) :
+                    R(0.0);
+                up = exp(dx + tilt);
+                down = exp(-dx + tilt);
+                pu = (growth - down)/(up - down);
+                R pd = R(1.0) - pu;
+                dx = dx*sqrt(variance/(R(4.0)*dx*dx*pu*pd));
+            }
+            detail::binomialUpDownCoefficients(up, down, a, b, c);
+        }
+    };
+
+    template <>
+    struct BinomialTreeParameters_2<Joshi4_2> {
+        static Size steps(Size steps) { return steps%2 ? steps : steps+1; }
+        template <class R>
+        static void compute(const R& x0, const R& drift, const R& variance,
+                            Size steps, const R& strike,
+                            R& pu, R& a, R& b, R& c) {
+            using std::exp;
+            using std::log;
+            using std::sqrt;
+            R totalVariance = variance*R(Real(steps));
+            R ermqdt = exp(drift + R(0.5)*variance);
+            R d2 = (log(x0/strike) + drift*R(Real(steps)))
+                /sqrt(totalVariance);
+            Real k = (steps-1.0)/2.0;
+            pu = upProbability(k, d2);
+            R pdash = upProbability(k, d2 + sqrt(totalVariance));
+            R up = ermqdt*pdash/pu;
+            R down = (ermqdt - pu*up)/(R(1.0) - pu);
+            detail::binomialUpDownCoefficients(up, down, a, b, c);
+        }
+      private:
+        // same as Joshi4_2::computeUpProb
+        template <class R>
+        static R upProbability(Real k, const R& dj) {
+            R alpha = dj/R(std::sqrt(8.0));
+            R alpha2 = alpha*alpha;
+            R alpha3 = alpha*alpha2;
+            R alpha5 = alpha3*alpha2;
+            R alpha7 = alpha5*alpha2;
+            R beta = R(-0.375)*alpha - alpha3;
+            R gamma = R(5.0/6.0)*alpha5 + R(13.0/12.0)*alpha3
+                + R(25.0/128.0)*alpha;
+            R delta = R(-0.1025)*alpha - R(0.9285)*alpha3
+                - R(1.43)*alpha5 - R(0.5)*alpha7;
+            Real rootk = std::sqrt(k);
+            return R(0.5) + alpha/R(rootk) + beta/R(k*rootk)
+                + gamma/R(k*k*rootk) + delta/R(k*k*k*rootk);
+        }
+    };
+
+
+    //! Adjoints of the inputs of a vanilla rollback
+    /*! Derivatives of the rolled-back value with respect to the
+        branch probabilities, the discount factor and the strike; the
+        node prices enter through S(i,j) = x0 e^{a+bi+cj} + shift(i),
+        and their adjoints are collected as
+        \f[
+            \sum \bar{S}_{i,j} (S_{i,j}-\mathrm{shift}_i) \, \{1, i, j\},
+        \f]
+        i.e., the derivatives with respect to log x0 (or a), b and c
+        in the representation of BinomialTreeParameters_2, and as
+        the sum of the adjoints on each slice for the shifts.
+    */
+    struct BinomialRollbackAdjoint_2 {
+        Real pu, pd, discount, strike;
+        Real scale, slope, ratio;
+        std::vector<Real> shift;
+    };
+
+
+    //! Reverse-mode differentiation of rollbackVanilla_2
+    /*! The values are rolled back as in rollbackVanilla_2, saving a
+        copy of one slice every sqrt(N); the adjoint sweep then runs
+        forwards from the given initial node, one block of slices at
+        a time, after recomputing the values in the block from the
+        saved slice above it.  The extra memory is O(N^{3/2}) and the
+        cost a small multiple of the rollback.
+
+        On return, \c values holds the initial values as for
+        rollbackVanilla_2, and \c adjoint the derivatives of the
+        value at initial node \c node.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaAdjoint_2(const BinomialSlices_2& slices,
+                                         DiscountFactor discount,
+                                         const PlainVanillaPayoff& payoff,
+                                         Size firstExerciseStep,
+                                         Array& values,
+                                         BinomialRollbackAdjoint_2& adjoint,
+                                         Size node = 1) {
+        Size steps = slices.steps();
+        QL_REQUIRE(node < slices.size(0),
+                   "initial node " << node << " out of range");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        Size block = std::max<Size>(Size(std::sqrt(Real(steps))), 1);
+
+        // forward sweep, saving one slice per block
+        std::vector<Size> saved;
+        std::vector<std::vector<Real> > savedValues;
+        detail::binomialTerminalValues(slices, omega, strike, values);
+        Size i = steps;
+        while (true) {
+            saved.push_back(i);
+            savedValues.push_back(std::vector<Real>(
+                           values.begin(), values.begin()+slices.size(i)));
+            if (i == 0)
+                break;
+            Size k = std::min(block, i);
+            detail::binomialAdvance(values.begin(), 0, slices.size(i-k),
+                                    i, k, slices, discount, omega, strike,
+                                    firstExerciseStep);
+            i -= k;
+        }
+
+        adjoint.pu = adjoint.pd = adjoint.discount = adjoint.strike = 0.0;
+        adjoint.scale = adjoint.slope = adjoint.ratio = 0.0;
+        adjoint.shift = std::vector<Real>(steps+1, 0.0);
+
+        // adjoint sweep, from t=0 to maturity; the adjoints are
+        // probabilities of reaching each node, times discount
+        // factors, and are dropped (as in BinomialBand_2) once they
+        // fall below the negligible threshold at the edges of the
+        // range [from,to) where they are kept
+        const Real negligible = QL_EPSILON*QL_EPSILON;
+        std::vector<Real> lambda(slices.size(steps)+1, 0.0);
+        lambda[node] = 1.0;
+        Size from = node, to = node+1;
+        Array buffer(slices.size(steps)+detail::binomialPadding, 0.0);
+        std::vector<std::vector<Real> > blockValues;
+        for (Size m=saved.size()-1; m-- > 0; ) {
+            Size lo = saved[m+1], hi = saved[m];
+            // values on slices lo+1 to hi
+            blockValues.resize(hi-lo);
+            blockValues[hi-lo-1] = savedValues[m];
+            std::copy(savedValues[m].begin(), savedValues[m].end(),
+                      buffer.begin());
+            for (Size s=hi-1; s>lo; --s) {
+                detail::binomialAdvance(buffer.begin(), 0, slices.size(s),
+                                        s+1, 1, slices, discount, omega,
+                                        strike, firstExerciseStep);
+                blockValues[s-lo-1].assign(buffer.begin(),
+                                           buffer.begin()+slices.size(s));
+            }
+            for (Size s=lo; s<hi; ++s) {
+                const std::vector<Real>& next = blockValues[s-lo];
+                Real pu = slices.pu(s), pd = slices.pd(s);
+                Real base = slices.base(s), shift = slices.shift(s);
+                const Real* powers = slices.powers();
+                bool exercisable = (s >= firstExerciseStep);
+                // adjoints held by the continuation values, weighted by
+                // the values below and above, and by exercised nodes
+                Real down = 0.0, up = 0.0;
+                Real exercised = 0.0, net = 0.0, netIndex = 0.0;
+                // adjoint held at the node below, not yet propagated
+                Real below = 0.0;
+                for (Size j=from; j<to; ++j) {
+                    Real bar = lambda[j];
+                    Real price = base*powers[j];
+                    bool exercise = exercisable &&
+                        (pd*next[j] + pu*next[j+1])*discount <
+                        omega*(price + shift - strike);
+                    Real e = exercise ? bar : 0.0;
+                    Real held = bar - e;
+                    down += held*next[j];
+                    up += held*next[j+1];
+                    exercised += e;
+                    net += e*price;
+                    netIndex += e*price*j;
+                    lambda[j] = (pd*held + pu*below)*discount;
+                    below = held;
+                }
+                lambda[to] = pu*below*discount;
+                adjoint.pd += down*discount;
+                adjoint.pu += up*discount;
+                adjoint.discount += pd*down + pu*up;
+                adjoint.scale += omega*net;
+                adjoint.slope += omega*net*s;
+                adjoint.ratio += omega*netIndex;
+                adjoint.shift[s] += omega*exercised;
+                adjoint.strike -= omega*exercised;
+
+                ++to;
+                while (to > from && std::fabs(lambda[to-1]) < negligible)
+                    lambda[--to] = 0.0;
+                while (from < to && std::fabs(lambda[from]) < negligible)
+                    lambda[from++] = 0.0;
+            }
+        }
+
+        // payoff
+        Real exercised = 0.0, net = 0.0, netIndex = 0.0;
+        for (Size j=from; j<to; ++j) {
+            if (omega*(slices.underlying(steps, j) - strike) > 0.0) {
+                Real price = slices.base(steps)*slices.powers()[j];
+                exercised += lambda[j];
+                net += lambda[j]*price;
+                netIndex += lambda[j]*price*j;
+            }
+        }
+        adjoint.scale += omega*net;
+        adjoint.slope += omega*net*steps;
+        adjoint.ratio += omega*netIndex;
+        adjoint.shift[steps] += omega*exercised;
+        adjoint.strike -= omega*exercised;
+    }
+
+
+    //! First-order sensitivities of a vanilla option on a binomial tree
+    /*! \ingroup lattices */
+    struct BinomialSensitivities_2 {
+        Real spot, riskFreeRate, dividendYield, volatility, strike, maturity;
+    };
+
+
+    //! Adjoint sensitivities on a constant-parameter tree
+    /*! The tree must have been built on the flat market given, as in
+        BinomialVanillaEngine_2, with the escrowed spot and the given
+        dividends.  The value at its middle initial node (x0) is rolled
+        back and differentiated with rollbackVanillaAdjoint_2; the
+        adjoints of the tree parameters are then carried back to the
+        market inputs through BinomialTreeParameters_2<T>, the
+        discount factor and the dividend adjustments.  The set of
+        dividends paid before each slice and the first exercise step
+        are kept fixed.
+
+        On return, \c values holds the option values at the initial
+        nodes, as for rollbackVanilla_2.
+
+        \ingroup lattices
+    */
+    template <class T>
+    BinomialSensitivities_2 binomialSensitivities_2(
+                                  const T& tree,
+                                  Size steps,
+                                  Real spot, Rate r, Rate q, Volatility v,
+                                  Time maturity,
+                                  const std::vector<Time>& dividendTimes,
+                                  const std::vector<Real>& dividendAmounts,
+                                  const PlainVanillaPayoff& payoff,
+                                  Size firstExerciseStep,
+                                  Array& values) {
+        typedef detail::BinomialDual_2 D;
+        QL_REQUIRE(T::constantParameters,
+                   "tree with constant parameters required");
+
+        BinomialSlices_2 slices(tree, steps);
+        DiscountFactor discount = std::exp(-r*(maturity/steps));
+        BinomialRollbackAdjoint_2 adjoint;
+        Size width = tree.initialWidth();
+        rollbackVanillaAdjoint_2(slices, discount, payoff,
+                                 firstExerciseStep, values, adjoint, width);
+
+        // tree parameters, with derivatives
+        D s0(spot, D::Spot), rate(r, D::RiskFreeRate),
+            yield(q, D::DividendYield), vol(v, D::Volatility),
+            strike(payoff.strike(), D::Strike), t(maturity, D::Maturity);
+        D x0 = s0;
+        for (Size k=0; k<dividendTimes.size(); ++k)
+            x0 = x0 - D(dividendAmounts[k])*
+                exp(-rate*D(dividendTimes[k]));
+        Size treeSteps = BinomialTreeParameters_2<T>::steps(steps);
+        D dt = t/D(Real(treeSteps));
+        D drift = (rate - yield - D(0.5)*vol*vol)*dt;
+        D variance = vol*vol*dt;
+        D pu, a, b, c;
+        BinomialTreeParameters_2<T>::compute(x0, drift, variance,
+                                             treeSteps, strike,
+                                             pu, a, b, c);
+        D disc = exp(-rate*t/D(Real(steps)));
+
+        BinomialSensitivities_2 results;
+        Real* outputs[] = { &results.spot, &results.riskFreeRate,
+                            &results.dividendYield, &results.volatility,
+                            &results.strike, &results.maturity };
+        for (Size k=0; k<D::Inputs; ++k) {
+            Real d = (adjoint.pu - adjoint.pd)*pu.derivative(k)
+                + adjoint.discount*disc.derivative(k)
+                + adjoint.scale*(x0.derivative(k)/x0.value()
+                                 + width*a.derivative(k))
+                + adjoint.slope*b.derivative(k)
+                + adjoint.ratio*c.derivative(k);
+            if (k == D::Strike)
+                d += adjoint.strike;
+            *outputs[k] = d;
+        }
+
+        // dividend adjustments: PV at slice i of the later dividends
+        for (Size i=0; i<=steps; ++i) {
+            if (adjoint.shift[i] == 0.0)
+                continue;
+            D ti = t*D(Real(i)/treeSteps);
+            for (Size k=0; k<dividendTimes.size(); ++k) {
+                if (dividendTimes[k] > ti.value()) {
+                    D pv = D(dividendAmounts[k])*
+                        exp(-rate*(D(dividendTimes[k]) - ti));
+                    for (Size m=0; m<D::Inputs; ++m)
+                        *outputs[m] += adjoint.shift[i]*pv.derivative(m);
+                }
+            }
+        }
+        return results;
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,316 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialboundary.hpp
+    \brief Early-exercise boundary of a binomial rollback
+*/
+
+#ifndef binomial_boundary_hpp
+#define binomial_boundary_hpp
+
+#include "binomialrollback.hpp"
+#include <ql/utilities/null.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        inline Real binomialExerciseValue(const BinomialSlices_2& slices,
+                                          Size i, Size j,
+                                          Real omega, Real strike) {
+            return omega*(slices.base(i)*slices.powers()[j]
+                          + slices.shift(i) - strike);
+        }
+
+        /* Whether node j of slice i, already rolled back, is
+           exercised.  The vectorized kernels may round the exercise
+           value differently from the scalar code, hence the
+           tolerance. */
+        inline bool binomialExercised(const BinomialSlices_2& slices,
+                                      Size i, Size j, Real value,
+                                      Real omega, Real strike) {
+            Real exercise =
+                binomialExerciseValue(slices, i, j, omega, strike);
+            return value <= exercise + 8.0*QL_EPSILON*
+                (std::fabs(exercise) + std::fabs(strike));
+        }
+
+        /* The exercised nodes of a vanilla option are the ones below
+           the critical price for a put and the ones above it for a
+           call.  Given the option values on slice i, returns the
+           first node on the other side of the boundary, i.e., the
+           first one which is not exercised for a put and the first
+           one which is for a call. */
+        inline Size binomialBoundaryNode(const BinomialSlices_2& slices,
+                                         Size i, const Real* v,
+                                         Real omega, Real strike) {
+            Size lo = 0, hi = slices.size(i);
+            while (lo < hi) {
+                Size mid = lo + (hi-lo)/2;
+                bool exercised =
+                    binomialExercised(slices, i, mid, v[mid], omega, strike);
+                if (exercised == (omega < 0.0))
+                    lo = mid+1;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+
+        // the critical price given the boundary node, or null if no
+        // node of the slice is exercised
+        inline Real binomialCriticalPrice(const BinomialSlices_2& slices,
+                                          Size i, Size b, Real omega) {
+            if (omega < 0.0)
+                return b > 0 ? slices.underlying(i, b-1) : Null<Real>();
+            else
+                return b < slices.size(i) ?
+                    slices.underlying(i, b) : Null<Real>();
+        }
+
+        // the inverse of the above on a possibly different tree
+        inline Size binomialGuessedNode(const BinomialSlices_2& slices,
+                                        Size i, Real criticalPrice,
+                                        Real omega) {
+            Size n = slices.size(i);
+            if (criticalPrice == Null<Real>())
+                return omega < 0.0 ? 0 : n;
+            Real ratio = (criticalPrice - slices.shift(i))/slices.base(i);
+            if (ratio <= 0.0)
+                return 0;
+            Real x = std::floor(std::log(ratio)/std::log(slices.ratio())
+                                + 0.5) + Real(slices.anchor());
+            if (omega < 0.0)
+                x += 1.0;
+            return x <= 0.0 ? 0 : Size(std::min(x, Real(n)));
+        }
+
+        // continuation values on [a, b) of slice i, leaving the
+        // values from b onwards, which the kernel may overwrite, as
+        // they were
+        inline void binomialContinuation(Real* v, Size a, Size b,
+                                         Size i,
+                                         const BinomialSlices_2& slices,
+                                         DiscountFactor discount) {
+            if (a == b)
+                return;
+            Real saved[binomialPadding];
+            std::copy(v+b, v+b+binomialPadding, saved);
+            binomialStep(v+a, b-a, slices.pu(i), slices.pd(i), discount, 0);
+            std::copy(saved, saved+binomialPadding, v+b);
+        }
+
+        /* Extends the nodes of slice i holding valid values from
+           [validLo, validHi) to at least [a, b); the ones added are
+           in the exercise region and get the exercise value. */
+        inline void binomialFillExercise(Real* v, Size a, Size b, Size i,
+                                         const BinomialSlices_2& slices,
+                                         Real omega, Real strike,
+                                         Size& validLo, Size& validHi) {
+            for (Size j=a; j<validLo; ++j)
+                v[j] = binomialExerciseValue(slices, i, j, omega, strike);
+            for (Size j=validHi; j<b; ++j)
+                v[j] = binomialExerciseValue(slices, i, j, omega, strike);
+            validLo = std::min(validLo, a);
+            validHi = std::max(validHi, b);
+        }
+
+        /* Rolls slice i+1 back to slice i using a guessed boundary
+           node.  The nodes more than guard nodes away from it on the
+           continuation side are rolled back without comparing with
+           the exercise value; the ones on the exercise side are not
+           computed at all, and only get their exercise value when a
+           later slice needs them (see binomialFillExercise), so that
+           each slice costs about as much as its continuation region.
+           The nodes within the guard are compared one by one.
+
+           On entry the values of slice i+1 are valid on
+           [validLo, validHi); on exit the range is updated for
+           slice i.  Returns the boundary node, or null if it was not
+           strictly inside the compared nodes, in which case the
+           slice is unreliable. */
+        inline Size binomialGuidedStep(Real* v, Size i, Size guess,
+                                       Size guard,
+                                       const BinomialSlices_2& slices,
+                                       DiscountFactor discount,
+                                       Real omega, Real strike,
+                                       Size& validLo, Size& validHi) {
+            Size n = slices.size(i);
+            Size lo = guess > guard ? guess-guard : 0;
+            Size hi = std::min(guess+guard, n);
+            if (omega < 0.0) {
+                binomialFillExercise(v, lo, n+1, i+1, slices, omega, strike,
+                                     validLo, validHi);
+            } else {
+                binomialFillExercise(v, 0, hi+1, i+1, slices, omega, strike,
+                                     validLo, validHi);
+                binomialContinuation(v, 0, lo, i, slices, discount);
+            }
+
+            Real pu = slices.pu(i), pd = slices.pd(i);
+            Real base = slices.base(i), shift = slices.shift(i);
+            const Real* powers = slices.powers();
+            Size b = Null<Size>();
+            bool consistent = true;
+            for (Size j=lo; j<hi; ++j) {
+                Real continuation = (pd*v[j] + pu*v[j+1])*discount;
+                Real exercise = omega*(base*powers[j] + shift - strike);
+                bool exercised = (continuation <= exercise);
+                v[j] = exercised ? exercise : continuation;
+                // exercised nodes come first for a put and last for
+                // a call; the first change of side is the boundary
+                if (exercised != (omega < 0.0)) {
+                    if (b == Null<Size>())
+                        b = j;
+                } else if (b != Null<Size>()) {
+                    consistent = false;
+                }
+            }
+            if (b == Null<Size>())
+                b = hi;
+
+            if (omega < 0.0) {
+                binomialContinuation(v, hi, n, i, slices, discount);
+                validLo = lo;
+                validHi = n;
+            } else {
+                validLo = 0;
+                validHi = hi;
+            }
+
+            if (!consistent || (lo > 0 && b == lo) || (hi < n && b == hi))
+                return Null<Size>();
+            return b;
+        }
+
+    }
+
+
+    //! In-place backward induction recording the exercise boundary
+    /*! Same as the serial rollbackVanillaFrom_2, but the critical
+        price on each slice from \c firstExerciseStep onwards, i.e.,
+        the price of the exercised node closest to the continuation
+        region, is stored in \c boundary (of size slices.steps()+1)
+        as the rollback goes.  Exercised nodes are assumed to lie
+        below the critical price for puts and above it for calls, as
+        is the case for vanilla options.  Slices on which no node is
+        exercised, as well as the ones before \c firstExerciseStep
+        and the ones from \c from onwards, which are not rolled back,
+        get a null critical price.
+
+        If the critical prices of a previous rollback on as many
+        slices are passed as \c guess, e.g., before a small change
+        in the market, the nodes more than \c guard nodes away from
+        the guessed boundary are taken as exercised or continued
+        without comparing the two values; only the ones within the
+        guard are compared.  Exercised nodes are not even computed
+        unless the next slice needs them.  This is checked on each slice: if the
+        boundary turns out not to be strictly within the compared
+        nodes, the rollback is restarted without the guess, and
+        false is returned.  The result is the same as the one of a
+        full rollback, up to rounding in the vectorized kernels.
+
+        The slices are rolled back one by one, without the tiling
+        of rollbackVanillaFrom_2.
+
+        \ingroup lattices
+    */
+    inline bool rollbackVanillaBoundary_2(const BinomialSlices_2& slices,
+                                          Size from,
+                                          DiscountFactor discount,
+                                          const PlainVanillaPayoff& payoff,
+                                          Size firstExerciseStep,
+                                          Array& values,
+                                          std::vector<Real>& boundary,
+                                          const std::vector<Real>& guess =
+                                                         std::vector<Real>(),
+                                          Size guard = 4) {
+        QL_REQUIRE(from <= slices.steps(),
+                   "slice " << from << " past the last one ("
+                   << slices.steps() << ")");
+        QL_REQUIRE(values.size() >= slices.size(from)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(from)+detail::binomialPadding
+                   << " elements required");
+        QL_REQUIRE(guess.empty() || guess.size() == slices.steps()+1,
+                   "guessed boundary on " << guess.size()
+                   << " slices given, " << slices.steps()+1 << " required");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        Real* v = values.begin();
+        boundary.assign(slices.steps()+1, Null<Real>());
+
+        // the values on slice from are kept in case the guess fails
+        Array start;
+        if (!guess.empty())
+            start = values;
+
+        bool guided = !guess.empty();
+        // nodes of the current slice holding valid values
+        Size validLo = 0, validHi = slices.size(from);
+        for (Size i=from; i-- > 0; ) {
+            if (i < firstExerciseStep) {
+                detail::binomialFillExercise(v, 0, slices.size(i+1), i+1,
+                                             slices, omega, strike,
+                                             validLo, validHi);
+                detail::binomialStep(v, slices.size(i), slices.pu(i),
+                                     slices.pd(i), discount, 0);
+                validHi = slices.size(i);
+                continue;
+            }
+            Size b;
+            if (guided) {
+                Size node = detail::binomialGuessedNode(slices, i, guess[i],
+                                                        omega);
+                b = detail::binomialGuidedStep(v, i, node, guard, slices,
+                                               discount, omega, strike,
+                                               validLo, validHi);
+                if (b == Null<Size>()) {
+                    // start over with full comparisons
+                    std::copy(start.begin(), start.end(), values.begin());
+                    guided = false;
+                    validLo = 0;
+                    validHi = slices.size(from);
+                    i = from;
+                    continue;
+                }
+            } else {
+                detail::BinomialExercise_2 exercise = {
+                    slices.base(i), slices.shift(i), omega, strike,
+                    slices.powers()
+                };
+                detail::binomialStep(v, slices.size(i), slices.pu(i),
+                                     slices.pd(i), discount, &exercise);
+                b = detail::binomialBoundaryNode(slices, i, v, omega, strike);
+                validHi = slices.size(i);
+            }
+            boundary[i] = detail::binomialCriticalPrice(slices, i, b, omega);
+        }
+        // the initial nodes skipped in the exercise region
+        if (from > 0 && firstExerciseStep == 0)
+            detail::binomialFillExercise(v, 0, slices.size(0), 0, slices,
+                                         omega, strike, validLo, validHi);
+        return guided;
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,523 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialchain.hpp
+    \brief Strike chains priced on a single binomial tree
+*/
+
+#ifndef binomial_chain_hpp
+#define binomial_chain_hpp
+
+#include "binomialengine.hpp"
+#include <ql/math/matrix.hpp>
+#include <algorithm>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        /* The chain is split into groups of binomialLanes payoffs,
+           padded with null ones; the values of a group are stored
+           node by node, one payoff per lane.  Each group is rolled
+           back separately. */
+
+        // exercise values on a slice of a group: for node j and lane
+        // k, omega[k]*(base*powers[j]+shift-strike[k])
+        struct BinomialChainExercise_2 {
+            Real base, shift;
+            const Real* powers;
+            const Real* omega;
+            const Real* strike;
+        };
+
+        // as for the single payoff, node j+1 is still at the later
+        // slice when node j is overwritten
+        inline void binomialChainStepScalar(
+                                 Real* v, Size n,
+                                 Real pu, Real pd, DiscountFactor disc,
+                                 const BinomialChainExercise_2* ex) {
+            for (Size j=0; j<n; ++j) {
+                Real* node = v + j*binomialLanes;
+                const Real* next = node + binomialLanes;
+                if (ex) {
+                    Real s = ex->base*ex->powers[j] + ex->shift;
+                    for (Size k=0; k<binomialLanes; ++k) {
+                        Real continuation = (pd*node[k] + pu*next[k])*disc;
+                        Real exercise = ex->omega[k]*(s - ex->strike[k]);
+                        node[k] = std::max(continuation, exercise);
+                    }
+                } else {
+                    for (Size k=0; k<binomialLanes; ++k)
+                        node[k] = (pd*node[k] + pu*next[k])*disc;
+                }
+            }
+        }
+
+        #if defined(QL_BINOMIAL_X86_SIMD)
+
+        __attribute__((target("avx2")))
+        inline void binomialChainStepAvx2(
+                                 Real* v, Size n,
+                                 Real pu, Real pd, DiscountFactor disc,
+                                 const BinomialChainExercise_2* ex) {
+            const __m256d vpu = _mm256_set1_pd(pu);
+            const __m256d vpd = _mm256_set1_pd(pd);
+            const __m256d vdisc = _mm256_set1_pd(disc);
+            if (ex) {
+                const __m256d omega0 = _mm256_loadu_pd(ex->omega);
+                const __m256d omega1 = _mm256_loadu_pd(ex->omega+4);
+                const __m256d strike0 = _mm256_loadu_pd(ex->strike);
+                const __m256d strike1 = _mm256_loadu_pd(ex->strike+4);
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    const __m256d s =
+                        _mm256_set1_pd(ex->base*ex->powers[j] + ex->shift);
+                    __m256d c0 = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(node)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(node+8))),
+                        vdisc);
+                    __m256d c1 = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(node+4)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(node+12))),
+                        vdisc);
+                    __m256d e0 = _mm256_mul_pd(omega0,
+                                               _mm256_sub_pd(s, strike0));
+                    __m256d e1 = _mm256_mul_pd(omega1,
+                                               _mm256_sub_pd(s, strike1));
+                    _mm256_storeu_pd(node, _mm256_max_pd(c0, e0));
+                    _mm256_storeu_pd(node+4, _mm256_max_pd(c1, e1));
+                }
+            } else {
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    __m256d c0 = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(node)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(node+8))),
+                        vdisc);
+                    __m256d c1 = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(node+4)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(node+12))),
+                        vdisc);
+                    _mm256_storeu_pd(node, c0);
+                    _mm256_storeu_pd(node+4, c1);
+                }
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline void binomialChainStepAvx512(
+                                 Real* v, Size n,
+                                 Real pu, Real pd, DiscountFactor disc,
+                                 const BinomialChainExercise_2* ex) {
+            const __m512d vpu = _mm512_set1_pd(pu);
+            const __m512d vpd = _mm512_set1_pd(pd);
+            const __m512d vdisc = _mm512_set1_pd(disc);
+            if (ex) {
+                const __m512d omega = _mm512_loadu_pd(ex->omega);
+                const __m512d strike = _mm512_loadu_pd(ex->strike);
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    const __m512d s =
+                        _mm512_set1_pd(ex->base*ex->powers[j] + ex->shift);
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(node)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(node+8))),
+                        vdisc);
+                    __m512d e = _mm512_mul_pd(omega,
+                                              _mm512_sub_pd(s, strike));
+                    _mm512_storeu_pd(node, _mm512_max_pd(c, e));
+                }
+            } else {
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(node)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(node+8))),
+                        vdisc);
+                    _mm512_storeu_pd(node, c);
+                }
+            }
+        }
+
+        #endif
+
+        typedef void (*BinomialChainStep_2)(Real*, Size, Real, Real,
+                                            DiscountFactor,
+                                            const BinomialChainExercise_2*);
+
+        inline BinomialChainStep_2 selectBinomialChainStep() {
+            #if defined(QL_BINOMIAL_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return &binomialChainStepAvx512;
+            if (__builtin_cpu_supports("avx2"))
+                return &binomialChainStepAvx2;
+            #endif
+            return &binomialChainStepScalar;
+        }
+
+        inline void binomialChainStep(Real* v, Size n,
+                                      Real pu, Real pd, DiscountFactor disc,
+                                      const BinomialChainExercise_2* ex) {
+            static const BinomialChainStep_2 step =
+                selectBinomialChainStep();
+            step(v, n, pu, pd, disc, ex);
+        }
+
+    }
+
+
+    //! Backward induction of several plain-vanilla payoffs at once
+    /*! The payoffs are rolled back together on the same tree, in
+        groups of detail::binomialLanes; within a group, the inner
+        loop runs across payoffs on AVX2 or AVX-512 registers when
+        available, and the node price entering the exercise values is
+        computed once for the whole group.
+
+        Payoff k expires on slice \c maturitySteps[k] and can be
+        exercised from slice \c firstExerciseSteps[k] on; a value not
+        lower than its maturity step means no early exercise.  The
+        payoffs are grouped by decreasing maturity, and each group is
+        rolled back from its latest maturity; the values of a payoff
+        stay null until its maturity, where its payoff is injected
+        into the sweep.  A whole strip of expiries thus costs about
+        as much as rolling back the longest one.
+
+        On return, \c values has one row per initial node and one
+        column per payoff.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaChain_2(
+                           const BinomialSlices_2& slices,
+                           DiscountFactor discount,
+                           const std::vector<PlainVanillaPayoff>& payoffs,
+                           const std::vector<Size>& maturitySteps,
+                           const std::vector<Size>& firstExerciseSteps,
+                           Matrix& values) {
+        QL_REQUIRE(!payoffs.empty(), "no payoffs given");
+        Size count = payoffs.size();
+        QL_REQUIRE(maturitySteps.size() == count &&
+                   firstExerciseSteps.size() == count,
+                   "wrong number of maturity or exercise steps ("
+                   << maturitySteps.size() << " and "
+                   << firstExerciseSteps.size() << " for "
+                   << count << " payoffs)");
+        for (Size k=0; k<count; ++k)
+            QL_REQUIRE(maturitySteps[k] > 0 &&
+                       maturitySteps[k] <= slices.steps(),
+                       "maturity step " << maturitySteps[k]
+                       << " outside the tree (1 to " << slices.steps()
+                       << ")");
+        const Size lanes = detail::binomialLanes;
+
+        // latest maturities first, so that groups are homogeneous
+        std::vector<Size> order(count);
+        for (Size k=0; k<count; ++k)
+            order[k] = k;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](Size a, Size b) {
+                             return maturitySteps[a] > maturitySteps[b];
+                         });
+
+        values = Matrix(slices.size(0), count);
+        std::vector<Real> v((slices.size(maturitySteps[order[0]])+1)*lanes);
+        for (Size g=0; g<count; g+=lanes) {
+            // padding lanes have null payoffs and stay null; the
+            // exercise values of a lane are only enabled between its
+            // first exercise step and its maturity
+            Real omega[lanes], strike[lanes], exerciseOmega[lanes];
+            Size maturity[lanes], firstExercise[lanes];
+            for (Size k=0; k<lanes; ++k) {
+                if (g+k < count) {
+                    const PlainVanillaPayoff& payoff = payoffs[order[g+k]];
+                    omega[k] = (payoff.optionType() == Option::Call ?
+                                1.0 : -1.0);
+                    strike[k] = payoff.strike();
+                    maturity[k] = maturitySteps[order[g+k]];
+                    firstExercise[k] = firstExerciseSteps[order[g+k]];
+                } else {
+                    omega[k] = strike[k] = 0.0;
+                    maturity[k] = firstExercise[k] = 0;
+                }
+            }
+
+            Size start = maturity[0];
+            std::fill(v.begin(), v.begin()+(slices.size(start)+1)*lanes,
+                      0.0);
+            detail::BinomialChainExercise_2 exercise = {
+                0.0, 0.0, slices.powers(), exerciseOmega, strike
+            };
+            for (Size i=start; i-- > 0; ) {
+                bool early = false;
+                for (Size k=0; k<lanes; ++k) {
+                    if (maturity[k] == i+1) {
+                        for (Size j=0; j<slices.size(i+1); ++j) {
+                            Real s = slices.underlying(i+1, j);
+                            v[j*lanes+k] =
+                                std::max(omega[k]*(s - strike[k]), 0.0);
+                        }
+                    }
+                    bool enabled = (i >= firstExercise[k] && i < maturity[k]);
+                    exerciseOmega[k] = enabled ? omega[k] : 0.0;
+                    early = early || enabled;
+                }
+                if (early) {
+                    exercise.base = slices.base(i);
+                    exercise.shift = slices.shift(i);
+                    detail::binomialChainStep(&v[0], slices.size(i),
+                                              slices.pu(i), slices.pd(i),
+                                              discount, &exercise);
+                } else {
+                    detail::binomialChainStep(&v[0], slices.size(i),
+                                              slices.pu(i), slices.pd(i),
+                                              discount, 0);
+                }
+            }
+
+            for (Size j=0; j<slices.size(0); ++j)
+                for (Size k=0; k<lanes && g+k<count; ++k)
+                    values[j][order[g+k]] = v[j*lanes+k];
+        }
+    }
+
+
+    //! Backward induction of payoffs sharing maturity and exercise
+    /*! Same as the above, with all payoffs expiring on the last
+        slice of the tree.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaChain_2(
+                               const BinomialSlices_2& slices,
+                               DiscountFactor discount,
+                               const std::vector<PlainVanillaPayoff>& payoffs,
+                               Size firstExerciseStep,
+                               Matrix& values) {
+        rollbackVanillaChain_2(slices, discount, payoffs,
+                               std::vector<Size>(payoffs.size(),
+                                                 slices.steps()),
+                               std::vector<Size>(payoffs.size(),
+                                                 firstExerciseStep),
+                               values);
+    }
+
+
+    //! Vanilla options on a chain of strikes priced on a single tree
+    /*! The market is flattened at the horizon and the tree, which
+        must not depend on the strike, is built once in the
+        constructor; each call to calculate() then prices a whole
+        chain of plain-vanilla payoffs.  European options are priced
+        by summing over the nodes of their maturity slice, which only
+        needs the shared tree; American options are rolled back
+        together with rollbackVanillaChain_2.  Greeks are computed
+        as in BinomialVanillaEngine_2.
+
+        When built with an exercise, all payoffs share it.  When
+        built with a horizon instead, each option is given its own
+        exercise, expiring no later than the horizon; expiries are
+        moved to the closest slice of the tree, so that the number of
+        steps should be chosen to put them on the grid.  In this
+        case, the whole strip is priced with the rates and volatility
+        flattened at the horizon, and the dividends until the horizon
+        are escrowed for all options.
+
+        The chain does not observe the market: a new one must be
+        built when the latter changes.
+
+        \ingroup vanillaengines
+    */
+    template <class T>
+    class BinomialVanillaChain_2 {
+      public:
+        //! options sharing the given exercise
+        BinomialVanillaChain_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const boost::shared_ptr<Exercise>& exercise,
+             Size timeSteps,
+             const DividendSchedule& dividends = DividendSchedule());
+        //! options expiring at different dates up to the horizon
+        BinomialVanillaChain_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const Date& horizon,
+             Size timeSteps,
+             const DividendSchedule& dividends = DividendSchedule());
+        //! prices the given payoffs with the chain's exercise
+        void calculate(const std::vector<PlainVanillaPayoff>& payoffs);
+        //! prices the given payoffs, each with its own exercise
+        void calculate(const std::vector<PlainVanillaPayoff>& payoffs,
+                       const std::vector<boost::shared_ptr<Exercise> >&
+                                                                   exercises);
+        //! \name Results of the last calculation
+        //@{
+        Size size() const { return value_.size(); }
+        Real value(Size k) const { return value_[k]; }
+        Real delta(Size k) const { return delta_[k]; }
+        Real gamma(Size k) const { return gamma_[k]; }
+        Real theta(Size k) const { return theta_[k]; }
+        //@}
+      private:
+        boost::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        boost::shared_ptr<Exercise> exercise_;
+        Size timeSteps_;
+        detail::BinomialMarket_2 market_;
+        boost::shared_ptr<T> tree_;
+        boost::shared_ptr<BinomialSlices_2> slices_;
+        std::vector<Real> value_, delta_, gamma_, theta_;
+    };
+
+
+    // template definitions
+
+    template <class T>
+    BinomialVanillaChain_2<T>::BinomialVanillaChain_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const boost::shared_ptr<Exercise>& exercise,
+             Size timeSteps,
+             const DividendSchedule& dividends)
+    : BinomialVanillaChain_2(process, exercise->lastDate(), timeSteps,
+                             dividends) {
+        exercise_ = exercise;
+    }
+
+    template <class T>
+    BinomialVanillaChain_2<T>::BinomialVanillaChain_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const Date& horizon,
+             Size timeSteps,
+             const DividendSchedule& dividends)
+    : process_(process), timeSteps_(timeSteps),
+      market_(process, dividends, horizon) {
+        QL_REQUIRE(T::strikeIndependent,
+                   "tree depending on the strike given");
+        QL_REQUIRE(timeSteps >= 2,
+                   "at least 2 time steps required, "
+                   << timeSteps << " provided");
+
+        // the strike is ignored by the trees allowed here
+        tree_ = boost::shared_ptr<T>(new T(market_.process,
+                                           market_.maturity, timeSteps,
+                                           market_.escrowedSpot));
+        if (!market_.dividendTimes.empty())
+            tree_->setDividends(market_.dividendTimes,
+                                market_.dividendAmounts,
+                                market_.riskFreeRate);
+        slices_ = boost::shared_ptr<BinomialSlices_2>(
+                                new BinomialSlices_2(*tree_, timeSteps));
+    }
+
+    template <class T>
+    void BinomialVanillaChain_2<T>::calculate(
+                              const std::vector<PlainVanillaPayoff>& payoffs) {
+        QL_REQUIRE(exercise_, "no exercise given to the chain");
+        calculate(payoffs, std::vector<boost::shared_ptr<Exercise> >(
+                                                  payoffs.size(), exercise_));
+    }
+
+    template <class T>
+    void BinomialVanillaChain_2<T>::calculate(
+                const std::vector<PlainVanillaPayoff>& payoffs,
+                const std::vector<boost::shared_ptr<Exercise> >& exercises) {
+        Size count = payoffs.size();
+        QL_REQUIRE(exercises.size() == count,
+                   count << " payoffs but " << exercises.size()
+                   << " exercises given");
+        TimeGrid grid(market_.maturity, timeSteps_);
+        DiscountFactor discount =
+            std::exp(-market_.riskFreeRate*(market_.maturity/timeSteps_));
+        bool closedForm = (tree_->probability(0, 0, 0) > 0.0 &&
+                           tree_->probability(0, 0, 1) > 0.0);
+
+        // option values at the three nodes at t=0, one column per payoff
+        Matrix va0(tree_->size(0), count);
+        std::vector<PlainVanillaPayoff> rolled;
+        std::vector<Size> rolledIndex, maturitySteps, firstExerciseSteps;
+        Array column;
+        for (Size k=0; k<count; ++k) {
+            const boost::shared_ptr<Exercise>& exercise = exercises[k];
+            QL_REQUIRE(exercise->type() != Exercise::Bermudan,
+                       "Bermudan exercise not supported");
+            Time maturity = process_->time(exercise->lastDate());
+            QL_REQUIRE(maturity <= market_.maturity*(1.0+1.0e-10),
+                       "option " << k << " expires after the horizon");
+            Size maturityStep = grid.closestIndex(maturity);
+            QL_REQUIRE(maturityStep > 0,
+                       "option " << k << " expires before the first step");
+
+            if (exercise->type() == Exercise::European && closedForm) {
+                europeanVanilla_2(*tree_, maturityStep, discount,
+                                  payoffs[k], column);
+                for (Size j=0; j<column.size(); ++j)
+                    va0[j][k] = column[j];
+            } else {
+                Size firstExerciseStep = maturityStep;
+                if (exercise->type() == Exercise::American) {
+                    Time earliest = process_->time(exercise->date(0));
+                    firstExerciseStep = 0;
+                    while (firstExerciseStep < maturityStep &&
+                           grid[firstExerciseStep] < earliest)
+                        ++firstExerciseStep;
+                }
+                rolled.push_back(payoffs[k]);
+                rolledIndex.push_back(k);
+                maturitySteps.push_back(maturityStep);
+                firstExerciseSteps.push_back(firstExerciseStep);
+            }
+        }
+        if (!rolled.empty()) {
+            Matrix rolledValues;
+            rollbackVanillaChain_2(*slices_, discount, rolled,
+                                   maturitySteps, firstExerciseSteps,
+                                   rolledValues);
+            for (Size m=0; m<rolled.size(); ++m)
+                for (Size j=0; j<rolledValues.rows(); ++j)
+                    va0[j][rolledIndex[m]] = rolledValues[j][m];
+        }
+
+        Real s0u = tree_->underlying(0, 2); // up price
+        Real s0m = tree_->underlying(0, 1); // middle price
+        Real s0d = tree_->underlying(0, 0); // down (low) price
+        Real h2 = s0u - s0m;
+        Real h1 = s0m - s0d;
+
+        value_.resize(count);
+        delta_.resize(count);
+        gamma_.resize(count);
+        theta_.resize(count);
+        for (Size k=0; k<count; ++k) {
+            Real f0 = va0[0][k];
+            Real f1 = va0[1][k];
+            Real f2 = va0[2][k];
+            value_[k] = f1;
+            gamma_[k] = 2*(h2*f0 - (h1+h2)*f1 + h1*f2)/((h1*h2)*(h1+h2));
+            delta_[k] = (-h2/(h1*(h1+h2)))*f0 - ((h1-h2)/(h1*h2))*f1
+                      + (h1/(h2*(h1+h2)))*f2;
+            theta_[k] = blackScholesTheta(process_, value_[k], delta_[k],
+                                          gamma_[k]);
+        }
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,249 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialdirect.hpp
+    \brief Direct pricing of vanilla options on binomial trees
+*/
+
+#ifndef binomial_direct_hpp
+#define binomial_direct_hpp
+
+#include "binomialadjoint.hpp"
+#include <ql/exercise.hpp>
+#include <ql/math/distributions/binomialdistribution.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace QuantLib {
+
+    //! Market and contract of a vanilla option, as plain numbers
+    /*! The market is flat and without dividends; the maturity is a
+        time in years.
+    */
+    struct BinomialOptionInputs_2 {
+        Real spot, strike;
+        Rate riskFreeRate, dividendYield;
+        Volatility volatility;
+        Time maturity;
+        Option::Type type;
+        Exercise::Type exercise;
+        Size steps;
+    };
+
+    //! Value and Greeks of an option
+    struct BinomialOptionResult_2 {
+        Real value, delta, gamma, theta;
+    };
+
+
+    namespace detail {
+
+        inline void binomialCheckInputs(const BinomialOptionInputs_2& inputs) {
+            QL_REQUIRE(inputs.spot > 0.0, "positive spot required");
+            QL_REQUIRE(inputs.strike > 0.0, "positive strike required");
+            QL_REQUIRE(inputs.volatility > 0.0,
+                       "positive volatility required");
+            QL_REQUIRE(inputs.maturity > 0.0, "positive maturity required");
+            QL_REQUIRE(inputs.steps >= 2,
+                       "at least 2 time steps required, "
+                       << inputs.steps << " provided");
+            QL_REQUIRE(inputs.exercise != Exercise::Bermudan,
+                       "Bermudan exercise not supported");
+        }
+
+        // parameters of the tree with the given steps on the inputs
+        template <class T>
+        void binomialDirectParameters(const BinomialOptionInputs_2& inputs,
+                                      Size steps,
+                                      Real& pu, Real& a, Real& b, Real& c) {
+            Rate r = inputs.riskFreeRate, q = inputs.dividendYield;
+            Volatility v = inputs.volatility;
+            Size treeSteps = BinomialTreeParameters_2<T>::steps(steps);
+            Time dt = inputs.maturity/treeSteps;
+            BinomialTreeParameters_2<T>::compute(inputs.spot,
+                                                 (r-q-0.5*v*v)*dt, v*v*dt,
+                                                 treeSteps, inputs.strike,
+                                                 pu, a, b, c);
+        }
+
+        /* Value and Greeks from the values f at the three initial
+           nodes x0 exp(a + c j), as in BinomialVanillaEngine_2; theta
+           follows from the Black-Scholes equation, as in
+           blackScholesTheta. */
+        inline BinomialOptionResult_2 binomialDirectResult(
+                                     const BinomialOptionInputs_2& inputs,
+                                     Real a, Real c, const Real* f) {
+            Real x0 = inputs.spot;
+            Rate r = inputs.riskFreeRate, q = inputs.dividendYield;
+            Volatility v = inputs.volatility;
+            Real s0u = x0*std::exp(a + 2.0*c); // up price
+            Real s0m = x0*std::exp(a + c); // middle price
+            Real s0d = x0*std::exp(a); // down (low) price
+            Real h2 = s0u - s0m;
+            Real h1 = s0m - s0d;
+            BinomialOptionResult_2 result;
+            result.value = f[1];
+            result.gamma = 2*(h2*f[0] - (h1+h2)*f[1] + h1*f[2])
+                         / ((h1*h2)*(h1+h2));
+            result.delta = (-h2/(h1*(h1+h2)))*f[0] - ((h1-h2)/(h1*h2))*f[1]
+                         + (h1/(h2*(h1+h2)))*f[2];
+            result.theta = r*result.value - (r-q)*x0*result.delta
+                         - 0.5*v*v*x0*x0*result.gamma;
+            return result;
+        }
+
+        /* European values at the three initial nodes of a tree with
+           node prices x0 exp(a + b i + c j): the expectation of the
+           payoff on slice n, as in binomialExpectation_2, but with
+           the weights computed on the fly from the mode outwards and
+           summed at once for the three nodes, so that nothing is
+           stored. */
+        inline void binomialEuropeanDirect(Real x0, Real a, Real b, Real c,
+                                           Real pu, Size n,
+                                           DiscountFactor discount,
+                                           Real omega, Real strike,
+                                           Real* values,
+                                           Real accuracy = 1.0e-16) {
+            Real pd = 1.0 - pu;
+            Real ratio = pu/pd;
+            Real q = std::exp(c);
+            Real scale = x0*std::exp(a + c) + strike;
+            Real offset = a + b*n;
+
+            Size mode = std::min<Size>(Size((n+1)*pu), n);
+            Real modeWeight = std::exp(binomialCoefficientLn(n, mode)
+                                       + mode*std::log(pu)
+                                       + (n-mode)*std::log(pd));
+            Real sums[3] = { 0.0, 0.0, 0.0 };
+            // adds the terms of the nodes m, m+1 and m+2 reached from
+            // the initial ones with weight w, and returns the highest
+            // payoff bound among them
+            auto add = [&](Size m, Real w) {
+                Real s = x0*std::exp(offset + c*m);
+                for (Size j=0; j<3; ++j, s *= q)
+                    sums[j] += w*std::max(omega*(s-strike), 0.0);
+                return std::max(s/q, strike);
+            };
+
+            add(mode, modeWeight);
+            Real w = modeWeight;
+            for (Size m=mode+1; m<=n; ++m) {
+                w *= ratio*Real(n-m+1)/Real(m);
+                // values reached from m are bounded by the top node
+                // (calls) or by the strike (puts)
+                if (w*add(m, w) < accuracy*scale)
+                    break;
+            }
+            w = modeWeight;
+            for (Size m=mode; m>0; --m) {
+                w *= Real(m)/(ratio*Real(n-m+1));
+                if (w*add(m-1, w) < accuracy*scale)
+                    break;
+            }
+
+            DiscountFactor totalDiscount = std::pow(discount, Real(n));
+            for (Size j=0; j<3; ++j)
+                values[j] = sums[j]*totalDiscount;
+        }
+
+    }
+
+
+    //! size of the workspace needed by binomialPrice_2, in reals
+    inline Size binomialWorkspaceSize_2(Size steps) {
+        return 2*(steps + 3 + detail::binomialPadding);
+    }
+
+    //! Value and Greeks of a vanilla option on a tree of type T
+    /*! The tree parameters are computed from
+        BinomialTreeParameters_2<T>, on three initial nodes as in
+        BinomialVanillaEngine_2, and delta and gamma are taken from
+        the values at these nodes; theta follows from the
+        Black-Scholes equation, as in blackScholesTheta.  Up to
+        rounding, the results are the ones of the engine on a flat
+        market with the same number of steps.
+
+        No processes, term structures, quotes, instruments or
+        engines are involved, and thus no observers or virtual
+        calls.  Nothing is allocated either: American options are
+        rolled back with the vectorized kernel of rollbackVanilla_2,
+        slice by slice, in the given workspace of at least
+        binomialWorkspaceSize_2(steps) elements, which can be reused
+        across calls (or live on the stack for small trees);
+        European ones are summed over the last slice without any
+        storage.  The rollback is not tiled, which is the fastest
+        for the small trees this is meant for.
+
+        An exception is raised for invalid inputs.
+
+        \ingroup vanillaengines
+    */
+    template <class T>
+    BinomialOptionResult_2 binomialPrice_2(
+                                     const BinomialOptionInputs_2& inputs,
+                                     Real* workspace) {
+        detail::binomialCheckInputs(inputs);
+        Size steps = inputs.steps;
+        Real x0 = inputs.spot, strike = inputs.strike;
+        Real pu, a, b, c;
+        detail::binomialDirectParameters<T>(inputs, steps, pu, a, b, c);
+        Real pd = 1.0 - pu;
+        DiscountFactor discount =
+            std::exp(-inputs.riskFreeRate*(inputs.maturity/steps));
+        Real omega = (inputs.type == Option::Call ? 1.0 : -1.0);
+
+        Real f[3];
+        if (inputs.exercise == Exercise::European && pu > 0.0 && pd > 0.0) {
+            detail::binomialEuropeanDirect(x0, a, b, c, pu, steps, discount,
+                                           omega, strike, f);
+        } else {
+            // the same node prices as in BinomialSlices_2, anchored
+            // at the middle node of the last slice
+            Size nodes = steps + 3;
+            Size padded = nodes + detail::binomialPadding;
+            Size anchor = (nodes-1)/2;
+            Real* values = workspace;
+            Real* powers = workspace + padded;
+            Real anchorPrice = x0*std::exp(a + b*steps + c*anchor);
+            for (Size j=0; j<nodes; ++j) {
+                powers[j] = x0*std::exp(a + b*steps + c*j)/anchorPrice;
+                values[j] = std::max(
+                    omega*(anchorPrice*powers[j] - strike), 0.0);
+            }
+            std::fill(powers+nodes, powers+padded, 0.0);
+            std::fill(values+nodes, values+padded, 0.0);
+
+            bool american = (inputs.exercise == Exercise::American);
+            for (Size i=steps; i-- > 0; ) {
+                Size middle = (i+2)/2;
+                detail::BinomialExercise_2 exercise = {
+                    x0*std::exp(a + b*i + c*middle)/powers[middle], 0.0,
+                    omega, strike, powers
+                };
+                detail::binomialStep(values, i+3, pu, pd, discount,
+                                     american ? &exercise : 0);
+            }
+            std::copy(values, values+3, f);
+        }
+
+        return detail::binomialDirectResult(inputs, a, c, f);
+    }
+
+}
+
+
+#endif
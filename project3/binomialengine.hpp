@@ -27,46 +27,608 @@
 #define binomial_engine_hpp
 
 
-#include <ql/methods/lattices/binomialtree.hpp>
-//#include <binomialtree.hpp>
+#include "binomialtree.hpp"
+#include "binomialrollback.hpp"
+#include "binomialeuropean.hpp"
+#include "binomialsmoothing.hpp"
+#include "binomialtruncation.hpp"
+#include "binomialrefinement.hpp"
+#include "binomialscenarios.hpp"
+#include "binomialadjoint.hpp"
+#include "binomialboundary.hpp"
+#include "binomialsurface.hpp"
 #include <ql/methods/lattices/bsmlattice.hpp>
 #include <ql/math/distributions/normaldistribution.hpp>
 #include <ql/pricingengines/vanilla/discretizedvanillaoption.hpp>
 #include <ql/pricingengines/greeks.hpp>
 #include <ql/processes/blackscholesprocess.hpp>
+#include <ql/quotes/simplequote.hpp>
 #include <ql/termstructures/yield/flatforward.hpp>
 #include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
+#include <chrono>
+#include <map>
 
 namespace QuantLib {
 
+    namespace detail {
+
+        /* Market seen by the trees: rates and volatility are
+           flattened at maturity, and the spot is net of the present
+           value of the discrete dividends paid until then (escrowed
+           dividend model.) */
+        struct BinomialMarket_2 {
+            BinomialMarket_2(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& p,
+                const DividendSchedule& dividends,
+                const Date& maturityDate);
+            //! same market with shifted rates and volatility
+            BinomialMarket_2 shifted(Rate dr, Rate dq, Volatility dv) const;
+            Rate riskFreeRate, dividendYield;
+            Volatility volatility;
+            Time maturity;
+            Real escrowedSpot;
+            std::vector<Time> dividendTimes;
+            std::vector<Real> dividendAmounts;
+            boost::shared_ptr<StochasticProcess1D> process;
+          private:
+            // builds the flat process from the above
+            void setup();
+            Date referenceDate_;
+            DayCounter rfdc_, divdc_, voldc_;
+            Calendar volcal_;
+            Handle<Quote> spot_;
+        };
+
+        inline BinomialMarket_2::BinomialMarket_2(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& p,
+                const DividendSchedule& dividends,
+                const Date& maturityDate)
+        : rfdc_(p->riskFreeRate()->dayCounter()),
+          divdc_(p->dividendYield()->dayCounter()),
+          voldc_(p->blackVolatility()->dayCounter()),
+          volcal_(p->blackVolatility()->calendar()),
+          spot_(p->stateVariable()) {
+
+            Real s0 = spot_->value();
+            QL_REQUIRE(s0 > 0.0, "negative or null underlying given");
+            volatility = p->blackVolatility()->blackVol(maturityDate, s0);
+            riskFreeRate = p->riskFreeRate()->zeroRate(maturityDate,
+                rfdc_, Continuous, NoFrequency);
+            dividendYield = p->dividendYield()->zeroRate(maturityDate,
+                divdc_, Continuous, NoFrequency);
+            referenceDate_ = p->riskFreeRate()->referenceDate();
+
+            maturity = rfdc_.yearFraction(referenceDate_, maturityDate);
+
+            for (Size k=0; k<dividends.size(); ++k) {
+                Time t = rfdc_.yearFraction(referenceDate_,
+                                            dividends[k]->date());
+                if (t > 0.0 && t <= maturity) {
+                    dividendTimes.push_back(t);
+                    dividendAmounts.push_back(dividends[k]->amount());
+                }
+            }
+
+            setup();
+        }
+
+        inline BinomialMarket_2 BinomialMarket_2::shifted(
+                                Rate dr, Rate dq, Volatility dv) const {
+            BinomialMarket_2 market(*this);
+            market.riskFreeRate += dr;
+            market.dividendYield += dq;
+            market.volatility += dv;
+            QL_REQUIRE(market.volatility > 0.0,
+                       "non-positive shifted volatility");
+            market.setup();
+            return market;
+        }
+
+        inline void BinomialMarket_2::setup() {
+            // binomial trees with constant coefficient
+            Handle<YieldTermStructure> flatRiskFree(
+                boost::shared_ptr<YieldTermStructure>(
+                    new FlatForward(referenceDate_, riskFreeRate, rfdc_)));
+            Handle<YieldTermStructure> flatDividends(
+                boost::shared_ptr<YieldTermStructure>(
+                    new FlatForward(referenceDate_, dividendYield, divdc_)));
+            Handle<BlackVolTermStructure> flatVol(
+                boost::shared_ptr<BlackVolTermStructure>(
+                    new BlackConstantVol(referenceDate_, volcal_,
+                                         volatility, voldc_)));
+
+            // escrowed dividends: the tree is built on the spot net of
+            // the present value of the dividends paid until maturity
+            escrowedSpot = spot_->value();
+            for (Size k=0; k<dividendTimes.size(); ++k)
+                escrowedSpot -= dividendAmounts[k]*
+                    std::exp(-riskFreeRate*dividendTimes[k]);
+            QL_REQUIRE(escrowedSpot > 0.0,
+                       "dividends exceed the underlying value");
+
+            Handle<Quote> treeSpot = dividendTimes.empty() ?
+                spot_ :
+                Handle<Quote>(boost::shared_ptr<Quote>(
+                                           new SimpleQuote(escrowedSpot)));
+
+            process = boost::shared_ptr<StochasticProcess1D>(
+                         new GeneralizedBlackScholesProcess(
+                                      treeSpot,
+                                      flatDividends, flatRiskFree, flatVol));
+        }
+
+
+        /* Trees built on a flat market, kept with the slices and the
+           lattice rolled back on them.  Entries are keyed by the
+           inputs that determine the tree (spot, rates, volatility,
+           maturity, steps and dividends, plus the strike for trees
+           that depend on it); the tree type and the initial width
+           are fixed for the cache.  The slices and the lattice are
+           built on first use.  The most recently used entries are
+           kept. */
+        template <class T>
+        class BinomialTreeCache_2 {
+          public:
+            explicit BinomialTreeCache_2(Size initialWidth = 1)
+            : initialWidth_(initialWidth) {}
+            class Entry {
+              public:
+                const boost::shared_ptr<T>& tree() const { return tree_; }
+                const BinomialSlices_2& slices() {
+                    if (!slices_)
+                        slices_ = boost::shared_ptr<BinomialSlices_2>(
+                                      new BinomialSlices_2(*tree_, steps_));
+                    return *slices_;
+                }
+                const boost::shared_ptr<BlackScholesLattice<T> >& lattice() {
+                    if (!lattice_)
+                        lattice_ = boost::shared_ptr<BlackScholesLattice<T> >(
+                            new BlackScholesLattice<T>(tree_, riskFreeRate_,
+                                                       maturity_, steps_));
+                    return lattice_;
+                }
+              private:
+                friend class BinomialTreeCache_2;
+                Size steps_;
+                Real spot_, strike_;
+                Rate riskFreeRate_, dividendYield_;
+                Volatility volatility_;
+                Time maturity_;
+                std::vector<Time> dividendTimes_;
+                std::vector<Real> dividendAmounts_;
+                boost::shared_ptr<T> tree_;
+                boost::shared_ptr<BinomialSlices_2> slices_;
+                boost::shared_ptr<BlackScholesLattice<T> > lattice_;
+            };
+            //! tree with the given steps on the given market
+            Entry& entry(const BinomialMarket_2& market, Size steps,
+                         Real strike);
+            void clear() { entries_.clear(); }
+          private:
+            enum { capacity = 8 };
+            Size initialWidth_;
+            // most recently used last
+            std::vector<boost::shared_ptr<Entry> > entries_;
+        };
+
+        template <class T>
+        typename BinomialTreeCache_2<T>::Entry&
+        BinomialTreeCache_2<T>::entry(const BinomialMarket_2& market,
+                                      Size steps, Real strike) {
+            Real key = T::strikeIndependent ? Null<Real>() : strike;
+            Real spot = market.escrowedSpot;
+            for (Size k=entries_.size(); k-- > 0; ) {
+                const Entry& e = *entries_[k];
+                if (e.steps_ == steps && e.spot_ == spot &&
+                    e.strike_ == key &&
+                    e.riskFreeRate_ == market.riskFreeRate &&
+                    e.dividendYield_ == market.dividendYield &&
+                    e.volatility_ == market.volatility &&
+                    e.maturity_ == market.maturity &&
+                    e.dividendTimes_ == market.dividendTimes &&
+                    e.dividendAmounts_ == market.dividendAmounts) {
+                    boost::shared_ptr<Entry> found = entries_[k];
+                    entries_.erase(entries_.begin()+k);
+                    entries_.push_back(found);
+                    return *found;
+                }
+            }
+
+            boost::shared_ptr<Entry> e(new Entry);
+            e->steps_ = steps;
+            e->spot_ = spot;
+            e->strike_ = key;
+            e->riskFreeRate_ = market.riskFreeRate;
+            e->dividendYield_ = market.dividendYield;
+            e->volatility_ = market.volatility;
+            e->maturity_ = market.maturity;
+            e->dividendTimes_ = market.dividendTimes;
+            e->dividendAmounts_ = market.dividendAmounts;
+            e->tree_ = boost::shared_ptr<T>(new T(market.process,
+                                                  market.maturity,
+                                                  steps, strike));
+            e->tree_->setInitialWidth(initialWidth_);
+            if (!market.dividendTimes.empty())
+                e->tree_->setDividends(market.dividendTimes,
+                                       market.dividendAmounts,
+                                       market.riskFreeRate);
+            if (entries_.size() == capacity)
+                entries_.erase(entries_.begin());
+            entries_.push_back(e);
+            return *e;
+        }
+
+    }
+
+
+    //! Optional features of BinomialVanillaEngine_2
+    /*! The defaults give a plain rollback; see the engine for what
+        each feature does and which ones can be combined.  The
+        fields are usually set through the named parameters of
+        MakeBinomialVanillaEngine_2.
+    */
+    struct BinomialEngineSettings_2 {
+        BinomialEngineSettings_2()
+        : smoothing(BinomialSmoothing_2::None), truncation(Null<Real>()),
+          refinedSteps(0), refinementFactor(4),
+          volatilityBump(Null<Real>()), rateBump(Null<Real>()),
+          adjointGreeks(false), spotLadder(1), timeBudget(Null<Real>()),
+          targetError(Null<Real>()), maxSteps(100000),
+          exerciseBoundary(false) {}
+        BinomialSmoothing_2::Type smoothing;
+        //! standard deviations kept around the forward, if not null
+        Real truncation;
+        //! adaptive mesh over the last refinedSteps slices, if any
+        Size refinedSteps, refinementFactor;
+        //! scenario Greeks, if not null
+        Volatility volatilityBump;
+        Rate rateBump;
+        bool adjointGreeks;
+        //! nodes on each side of the spot at t=0
+        Size spotLadder;
+        //! anytime pricing, if either is not null
+        Time timeBudget;
+        Real targetError;
+        Size maxSteps;
+        bool exerciseBoundary;
+        boost::shared_ptr<BinomialValueSurface_2> valueSurface;
+    };
+
+
     //! Pricing engine for vanilla options using binomial trees
     /*! \ingroup vanillaengines
 
         \test the correctness of the returned values is tested by
               checking it against analytic results.
 
-        \todo Greeks are not overly accurate. They could be improved
-              by building a tree so that it has three points at the
-              current time. The value would be fetched from the middle
-              one, while the two side points would be used for
-              estimating partial derivatives.
+        Discrete dividends paid before expiry are handled with the
+        escrowed-dividend model: the tree is built on the spot net of
+        the present value of the dividends, which is added back to
+        the node prices.
+
+        If a thread pool is given, trees with constant parameters are
+        rolled back on all its threads; the results are identical to
+        the serial ones.
+
+        European options on trees with constant parameters are not
+        rolled back: the values at the three initial nodes, and thus
+        delta and gamma, are sums over the terminal nodes weighted by
+        the binomial distribution (see europeanVanilla_2.)
+
+        With Black-Scholes smoothing, the option values on the
+        penultimate slice are Black-Scholes prices (floored by the
+        exercise value for American options) instead of being rolled
+        back from the payoff.  With Richardson extrapolation, the
+        smoothed value, delta and gamma are computed with N and N/2
+        steps and extrapolated as 2f(N)-f(N/2).  Smoothing is not
+        available for Bermudan options.
+
+        If a truncation is given, options that need a rollback on a
+        tree with constant parameters are only rolled back on the
+        nodes within the given number of standard deviations of the
+        forward (see BinomialBand_2), with Black-Scholes values,
+        floored by the exercise value when allowed, on the boundary.
+        This reduces the work to O(N^{3/2}); the thread pool is not
+        used.  An estimated bound of the error is returned as the
+        "truncationBound" additional result.
+
+        With an adaptive mesh, the values near the strike over the
+        last few slices are computed on a finer sub-lattice (see
+        refineNearStrike_2.)  This takes the place of Black-Scholes
+        smoothing, with which it cannot be combined, and can be
+        combined with Richardson extrapolation.  It requires a tree
+        with constant parameters and is not available for Bermudan
+        options.
+
+        With scenario Greeks, the flattened market is also shifted
+        up and down by the given volatility and rate bumps (the
+        latter applied to the risk-free rate and the dividend yield
+        in turn), and the seven resulting trees are rolled back
+        together, one per lane (see rollbackVanillaScenarios_2);
+        vega, rho and dividend rho are returned as central
+        differences along with the other results.  European options
+        are summed over the terminal nodes of each tree instead.  It
+        requires a tree with constant parameters and cannot be
+        combined with smoothing, truncation or the adaptive mesh; it
+        is not available for Bermudan options.
+
+        With adjoint Greeks, the tree is differentiated in reverse
+        mode instead (see binomialSensitivities_2): vega, rho and
+        dividend rho are exact derivatives of the tree value, and
+        the derivatives with respect to the spot, the strike and the
+        maturity are returned as the "spotSensitivity",
+        "strikeSensitivity" and "maturitySensitivity" additional
+        results.  Their cost is a small multiple of the one of a
+        rollback.  The same restrictions as for scenario Greeks
+        apply, and the two cannot be combined.
+
+        With a spot ladder of width m, the trees carry 2m+1 nodes at
+        t=0 instead of three (see BinomialTree_2::setInitialWidth),
+        and the option values on all of them, i.e., at 2m+1 spot
+        levels around the current one, are returned from a single
+        rollback as the "spotLadderValues" additional result, with
+        the spot levels as "spotLadder".  Delta and gamma are still
+        taken from the middle three nodes.  The ladder cannot be
+        combined with Richardson extrapolation, which would mix
+        different spot levels.
+
+        The flattened market is kept between calculations until the
+        engine is notified of a change in the process; the trees,
+        with their slices and lattices, are kept as long as the
+        flattened market they were built on is the same, so that
+        repeated calculations on an unchanged market only cost the
+        rollback.
+
+        With a time budget or a target error, the engine prices
+        anytime: the option is priced with the given number of steps,
+        then with twice as many, and so on.  Since the error is O(1/N),
+        the difference between the last two prices estimates the one
+        of the last (as in Richardson extrapolation) and is returned
+        as the "estimatedError" additional result, along with the
+        last number of steps as "timeSteps" and the extrapolated
+        value 2f(N)-f(N/2) as "extrapolatedValue".  The doubling stops
+        when the estimated error is below the target, when the next
+        price is not expected to be ready before the time budget, in
+        seconds from the start of the calculation, runs out, or when
+        the maximum number of steps would be exceeded; the first
+        price is always computed.  The results are the ones on the
+        finest tree.  It cannot be combined with Richardson
+        extrapolation, scenario Greeks or adjoint Greeks.
+
+        With the exercise boundary, American options on trees with
+        constant parameters record the critical price on each slice
+        during the rollback (see rollbackVanillaBoundary_2); it is
+        returned as the "exerciseBoundary" additional result, with
+        the slice times as "exerciseBoundaryTimes", and null where
+        no node is exercised.  The boundary is kept by the engine,
+        across changes in the process, and used as a guess by the
+        next rollback with the same steps, strike and option type,
+        so that repricings after small market moves skip the
+        comparison with the exercise value away from the boundary.
+        The thread pool is not used; the boundary cannot be combined
+        with truncation, scenario Greeks or adjoint Greeks.
+
+        With a value surface, the option values around the spot on
+        the early slices are kept after each rollback (see
+        BinomialValueSurface_2 and rollbackVanillaSurface_2), and
+        European options are rolled back instead of being summed so
+        that they have one.  Later requests for the same contract on
+        the same flat market, a little later and at a nearby spot,
+        are then served by interpolation on the surface without
+        building or rolling back a tree; the time elapsed since the
+        rollback is returned as the "valueSurfaceElapsed" additional
+        result.  Requests outside the tolerance region of the
+        surface are repriced in full, which records it again around
+        the new spot and time.  A spot ladder as wide as the spot
+        range of the surface lets it serve requests right after the
+        rollback.  The surface is given by the caller, so that it
+        can be shared, saved to a file or loaded from one.  Only
+        European options and American ones exercisable from the
+        start use it.  It requires a tree with constant
+        parameters and no dividends, and cannot be combined with
+        Richardson extrapolation, truncation, scenario or adjoint
+        Greeks, anytime pricing or the exercise boundary; the thread
+        pool is not used for the rollbacks that record it.
     */
     template <class T>
     class BinomialVanillaEngine_2 : public VanillaOption::engine {
       public:
         BinomialVanillaEngine_2(
              const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
-             Size timeSteps)
-        : process_(process), timeSteps_(timeSteps) {
+             Size timeSteps,
+             const DividendSchedule& dividends = DividendSchedule(),
+             const boost::shared_ptr<ThreadPool_2>& pool =
+                                          boost::shared_ptr<ThreadPool_2>(),
+             const BinomialEngineSettings_2& settings =
+                                                  BinomialEngineSettings_2())
+        : process_(process), timeSteps_(timeSteps), dividends_(dividends),
+          pool_(pool), smoothing_(settings.smoothing),
+          truncation_(settings.truncation),
+          refinedSteps_(settings.refinedSteps),
+          refinementFactor_(settings.refinementFactor),
+          volatilityBump_(settings.volatilityBump),
+          rateBump_(settings.rateBump),
+          adjointGreeks_(settings.adjointGreeks),
+          spotLadder_(settings.spotLadder),
+          timeBudget_(settings.timeBudget),
+          targetError_(settings.targetError),
+          maxSteps_(settings.maxSteps),
+          exerciseBoundary_(settings.exerciseBoundary),
+          valueSurface_(settings.valueSurface),
+          boundaryStrike_(Null<Real>()), boundaryType_(Option::Put),
+          trees_(settings.spotLadder) {
+            bool richardson =
+                (smoothing_ == BinomialSmoothing_2::Richardson);
+            bool truncated = (truncation_ != Null<Real>());
+            bool refined = (refinedSteps_ > 0);
+            bool scenarios = (volatilityBump_ != Null<Real>());
+            bool anytime = (timeBudget_ != Null<Real>() ||
+                            targetError_ != Null<Real>());
+
             QL_REQUIRE(timeSteps >= 2,
                        "at least 2 time steps required, "
                        << timeSteps << " provided");
+            QL_REQUIRE(!truncated || truncation_ > 0.0,
+                       "positive truncation required, "
+                       << truncation_ << " provided");
+            QL_REQUIRE(!refined ||
+                       (T::constantParameters &&
+                        smoothing_ != BinomialSmoothing_2::BlackScholes),
+                       "adaptive mesh requires a tree with constant "
+                       "parameters and no Black-Scholes smoothing");
+            QL_REQUIRE(!richardson || timeSteps >= 4,
+                       "at least 4 time steps required for Richardson "
+                       "extrapolation, " << timeSteps << " provided");
+            QL_REQUIRE(scenarios == (rateBump_ != Null<Real>()),
+                       "both volatility and rate bumps required");
+            QL_REQUIRE(!scenarios ||
+                       (volatilityBump_ > 0.0 && rateBump_ > 0.0),
+                       "positive bumps required");
+            QL_REQUIRE(!scenarios ||
+                       (T::constantParameters &&
+                        smoothing_ == BinomialSmoothing_2::None &&
+                        !truncated && !refined),
+                       "scenario Greeks require a tree with constant "
+                       "parameters and no smoothing, truncation or "
+                       "adaptive mesh");
+            QL_REQUIRE(!adjointGreeks_ ||
+                       (T::constantParameters &&
+                        smoothing_ == BinomialSmoothing_2::None &&
+                        !truncated && !refined && !scenarios),
+                       "adjoint Greeks require a tree with constant "
+                       "parameters and no smoothing, truncation, "
+                       "adaptive mesh or scenario Greeks");
+            QL_REQUIRE(spotLadder_ >= 1,
+                       "at least one node on each side of the spot "
+                       "required");
+            QL_REQUIRE(spotLadder_ == 1 || !richardson,
+                       "spot ladder not available with Richardson "
+                       "extrapolation");
+            QL_REQUIRE(timeBudget_ == Null<Real>() || timeBudget_ > 0.0,
+                       "positive time budget required, "
+                       << timeBudget_ << " provided");
+            QL_REQUIRE(targetError_ == Null<Real>() || targetError_ > 0.0,
+                       "positive target error required, "
+                       << targetError_ << " provided");
+            QL_REQUIRE(!anytime ||
+                       (!richardson && !scenarios && !adjointGreeks_),
+                       "anytime pricing not available with Richardson "
+                       "extrapolation, scenario Greeks or adjoint Greeks");
+            QL_REQUIRE(!anytime || maxSteps_ >= timeSteps,
+                       "maximum number of steps (" << maxSteps_
+                       << ") less than the initial one ("
+                       << timeSteps << ")");
+            QL_REQUIRE(!exerciseBoundary_ ||
+                       (T::constantParameters && !truncated &&
+                        !scenarios && !adjointGreeks_),
+                       "exercise boundary requires a tree with constant "
+                       "parameters and no truncation, scenario Greeks or "
+                       "adjoint Greeks");
+            QL_REQUIRE(!valueSurface_ ||
+                       (T::constantParameters && dividends.empty() &&
+                        !richardson && !truncated && !scenarios &&
+                        !adjointGreeks_ && !anytime && !exerciseBoundary_),
+                       "value surface requires a tree with constant "
+                       "parameters and no dividends, Richardson "
+                       "extrapolation, truncation, scenario Greeks, "
+                       "adjoint Greeks, anytime pricing or exercise "
+                       "boundary");
             registerWith(process_);
         }
         void calculate() const;
+        void update() {
+            market_.reset();
+            VanillaOption::engine::update();
+        }
       private:
+        // flattened market at the given maturity, built if needed
+        const detail::BinomialMarket_2& market(const Date& maturity) const;
+        // value, delta and gamma on a tree with the given steps; the
+        // truncation bound is null if no truncation was performed
+        void calculate(Size steps,
+                       const detail::BinomialMarket_2& market,
+                       const boost::shared_ptr<PlainVanillaPayoff>& payoff,
+                       Real& value, Real& delta, Real& gamma,
+                       Real& truncationBound) const;
+        // all results from the scenario trees
+        void calculateScenarios(
+                   const detail::BinomialMarket_2& market,
+                   const boost::shared_ptr<PlainVanillaPayoff>& payoff) const;
+        // all results from the adjoint of the tree
+        void calculateAdjoint(
+                   const detail::BinomialMarket_2& market,
+                   const boost::shared_ptr<PlainVanillaPayoff>& payoff) const;
+        // contract and market the value surface is recorded for
+        BinomialSurfaceKey_2 surfaceKey(
+                         const detail::BinomialMarket_2& market,
+                         const PlainVanillaPayoff& payoff) const;
+        // all results from doubling step counts until the target
+        // error, the time budget or the maximum steps are reached
+        void calculateAnytime(
+                   std::chrono::steady_clock::time_point start,
+                   const detail::BinomialMarket_2& market,
+                   const boost::shared_ptr<PlainVanillaPayoff>& payoff) const;
         boost::shared_ptr<GeneralizedBlackScholesProcess> process_;
         Size timeSteps_;
+        DividendSchedule dividends_;
+        boost::shared_ptr<ThreadPool_2> pool_;
+        BinomialSmoothing_2::Type smoothing_;
+        Real truncation_;
+        Size refinedSteps_, refinementFactor_;
+        Volatility volatilityBump_;
+        Rate rateBump_;
+        bool adjointGreeks_;
+        Size spotLadder_;
+        Time timeBudget_;
+        Real targetError_;
+        Size maxSteps_;
+        bool exerciseBoundary_;
+        boost::shared_ptr<BinomialValueSurface_2> valueSurface_;
+        // critical prices of the last rollback for each number of
+        // steps, all for the same payoff
+        mutable std::map<Size, std::vector<Real> > boundaries_;
+        mutable Real boundaryStrike_;
+        mutable Option::Type boundaryType_;
+        mutable boost::shared_ptr<detail::BinomialMarket_2> market_;
+        mutable Date marketMaturity_;
+        mutable detail::BinomialTreeCache_2<T> trees_;
+    };
+
+
+    //! Binomial engine factory
+    template <class T>
+    class MakeBinomialVanillaEngine_2 {
+      public:
+        MakeBinomialVanillaEngine_2(
+                    const boost::shared_ptr<GeneralizedBlackScholesProcess>&);
+        // named parameters
+        MakeBinomialVanillaEngine_2& withSteps(Size steps);
+        MakeBinomialVanillaEngine_2& withDividends(const DividendSchedule&);
+        MakeBinomialVanillaEngine_2& withThreadPool(
+                                     const boost::shared_ptr<ThreadPool_2>&);
+        MakeBinomialVanillaEngine_2& withSmoothing(BinomialSmoothing_2::Type);
+        MakeBinomialVanillaEngine_2& withTruncation(Real deviations);
+        MakeBinomialVanillaEngine_2& withAdaptiveMesh(Size refinedSteps,
+                                                      Size factor = 4);
+        MakeBinomialVanillaEngine_2& withScenarioGreeks(
+                                        Volatility volatilityBump = 1.0e-3,
+                                        Rate rateBump = 1.0e-4);
+        MakeBinomialVanillaEngine_2& withAdjointGreeks(bool b = true);
+        MakeBinomialVanillaEngine_2& withSpotLadder(Size m);
+        MakeBinomialVanillaEngine_2& withTimeBudget(Time seconds);
+        MakeBinomialVanillaEngine_2& withTargetError(Real error);
+        MakeBinomialVanillaEngine_2& withMaxSteps(Size steps);
+        MakeBinomialVanillaEngine_2& withExerciseBoundary(bool b = true);
+        MakeBinomialVanillaEngine_2& withValueSurface(
+                          const boost::shared_ptr<BinomialValueSurface_2>&);
+        // conversion to pricing engine
+        operator boost::shared_ptr<PricingEngine>() const;
+      private:
+        boost::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        Size steps_;
+        DividendSchedule dividends_;
+        boost::shared_ptr<ThreadPool_2> pool_;
+        BinomialEngineSettings_2 settings_;
     };
 
 
@@ -75,73 +637,303 @@ namespace QuantLib {
     template <class T>
     void BinomialVanillaEngine_2<T>::calculate() const {
 
-        DayCounter rfdc  = process_->riskFreeRate()->dayCounter();
-        DayCounter divdc = process_->dividendYield()->dayCounter();
-        DayCounter voldc = process_->blackVolatility()->dayCounter();
-        Calendar volcal = process_->blackVolatility()->calendar();
-
-        Real s0 = process_->stateVariable()->value();
-        QL_REQUIRE(s0 > 0.0, "negative or null underlying given");
-        Volatility v = process_->blackVolatility()->blackVol(
-            arguments_.exercise->lastDate(), s0);
-        Date maturityDate = arguments_.exercise->lastDate();
-        Rate r = process_->riskFreeRate()->zeroRate(maturityDate,
-            rfdc, Continuous, NoFrequency);
-        Rate q = process_->dividendYield()->zeroRate(maturityDate,
-            divdc, Continuous, NoFrequency);
-        Date referenceDate = process_->riskFreeRate()->referenceDate();
-
-        // binomial trees with constant coefficient
-        Handle<YieldTermStructure> flatRiskFree(
-            boost::shared_ptr<YieldTermStructure>(
-                new FlatForward(referenceDate, r, rfdc)));
-        Handle<YieldTermStructure> flatDividends(
-            boost::shared_ptr<YieldTermStructure>(
-                new FlatForward(referenceDate, q, divdc)));
-        Handle<BlackVolTermStructure> flatVol(
-            boost::shared_ptr<BlackVolTermStructure>(
-                new BlackConstantVol(referenceDate, volcal, v, voldc)));
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
 
         boost::shared_ptr<PlainVanillaPayoff> payoff =
             boost::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
         QL_REQUIRE(payoff, "non-plain payoff given");
 
-        Time maturity = rfdc.yearFraction(referenceDate, maturityDate);
+        const detail::BinomialMarket_2& market =
+            this->market(arguments_.exercise->lastDate());
 
-        boost::shared_ptr<StochasticProcess1D> bs(
-                         new GeneralizedBlackScholesProcess(
-                                      process_->stateVariable(),
-                                      flatDividends, flatRiskFree, flatVol));
+        if (valueSurface_ &&
+            (arguments_.exercise->type() == Exercise::European ||
+             (arguments_.exercise->type() == Exercise::American &&
+              process_->time(arguments_.exercise->date(0)) <= 0.0))) {
+            // served from the last rollback if close enough
+            Real value, delta, gamma;
+            if (valueSurface_->interpolate(surfaceKey(market, *payoff),
+                                           market.escrowedSpot,
+                                           value, delta, gamma)) {
+                results_.value = value;
+                results_.delta = delta;
+                results_.gamma = gamma;
+                results_.theta = blackScholesTheta(process_,
+                                                   results_.value,
+                                                   results_.delta,
+                                                   results_.gamma);
+                results_.additionalResults["valueSurfaceElapsed"] =
+                    valueSurface_->header().key.maturity - market.maturity;
+                return;
+            }
+        }
+
+        if (volatilityBump_ != Null<Real>()) {
+            QL_REQUIRE(arguments_.exercise->type() != Exercise::Bermudan,
+                       "scenario Greeks not available for Bermudan options");
+            calculateScenarios(market, payoff);
+            return;
+        }
+        if (adjointGreeks_) {
+            QL_REQUIRE(arguments_.exercise->type() != Exercise::Bermudan,
+                       "adjoint Greeks not available for Bermudan options");
+            calculateAdjoint(market, payoff);
+            return;
+        }
+
+        QL_REQUIRE((smoothing_ == BinomialSmoothing_2::None &&
+                    refinedSteps_ == 0) ||
+                   arguments_.exercise->type() != Exercise::Bermudan,
+                   "smoothing not available for Bermudan options");
+
+        if (timeBudget_ != Null<Real>() || targetError_ != Null<Real>()) {
+            calculateAnytime(start, market, payoff);
+            return;
+        }
+
+        Real value2, delta2, gamma2, truncationBound2;
+        if (smoothing_ == BinomialSmoothing_2::Richardson) {
+            // the smoothed error is O(1/N): extrapolate from N/2 steps,
+            // calculated first so that the additional results are the
+            // ones on N steps
+            calculate(timeSteps_/2, market, payoff,
+                      value2, delta2, gamma2, truncationBound2);
+        }
+        Real value, delta, gamma, truncationBound;
+        calculate(timeSteps_, market, payoff,
+                  value, delta, gamma, truncationBound);
+        if (smoothing_ == BinomialSmoothing_2::Richardson) {
+            value = 2.0*value - value2;
+            delta = 2.0*delta - delta2;
+            gamma = 2.0*gamma - gamma2;
+            truncationBound = 2.0*truncationBound + truncationBound2;
+        }
+        if (truncationBound > 0.0)
+            results_.additionalResults["truncationBound"] = truncationBound;
+
+        // Store results
+        results_.value = value;
+        results_.delta = delta;
+        results_.gamma = gamma;
+        results_.theta = blackScholesTheta(process_,
+                                           results_.value,
+                                           results_.delta,
+                                           results_.gamma);
+    }
+
+
+    template <class T>
+    const detail::BinomialMarket_2& BinomialVanillaEngine_2<T>::market(
+                                            const Date& maturityDate) const {
+        if (!market_ || marketMaturity_ != maturityDate) {
+            market_ = boost::shared_ptr<detail::BinomialMarket_2>(
+                new detail::BinomialMarket_2(process_, dividends_,
+                                             maturityDate));
+            marketMaturity_ = maturityDate;
+        }
+        return *market_;
+    }
 
-        TimeGrid grid(maturity, timeSteps_);
 
-        boost::shared_ptr<T> tree(new T(bs, maturity, timeSteps_,
-                                        payoff->strike()));
+    template <class T>
+    BinomialSurfaceKey_2 BinomialVanillaEngine_2<T>::surfaceKey(
+                                   const detail::BinomialMarket_2& market,
+                                   const PlainVanillaPayoff& payoff) const {
+        BinomialSurfaceKey_2 key = {
+            payoff.strike(), market.riskFreeRate, market.dividendYield,
+            market.volatility, market.maturity,
+            payoff.optionType(), arguments_.exercise->type(),
+            T::treeType, smoothing_, timeSteps_, refinedSteps_,
+            refinedSteps_ > 0 ? refinementFactor_ : 0
+        };
+        return key;
+    }
+
+
+    template <class T>
+    void BinomialVanillaEngine_2<T>::calculate(
+                   Size steps,
+                   const detail::BinomialMarket_2& market,
+                   const boost::shared_ptr<PlainVanillaPayoff>& payoff,
+                   Real& value, Real& delta, Real& gamma,
+                   Real& truncationBound) const {
 
-        boost::shared_ptr<BlackScholesLattice<T> > lattice(
-            new BlackScholesLattice<T>(tree, r, maturity, timeSteps_));
+        truncationBound = 0.0;
 
-        DiscretizedVanillaOption option(arguments_, *process_, grid);
+        Rate r = market.riskFreeRate;
+        Rate q = market.dividendYield;
+        Volatility v = market.volatility;
+        Time maturity = market.maturity;
+        TimeGrid grid(maturity, steps);
 
-        option.initialize(lattice, maturity);
+        typename detail::BinomialTreeCache_2<T>::Entry& cached =
+            trees_.entry(market, steps, payoff->strike());
+        const boost::shared_ptr<T>& tree = cached.tree();
 
         // Partial derivatives calculated from various points in the
         // binomial tree 
         // (see J.C.Hull, "Options, Futures and other derivatives", 6th edition, pp 397/398
 
+        // option values (p0) at the three nodes at t=0
+        Array va0;
+        if (arguments_.exercise->type() == Exercise::Bermudan) {
+            const boost::shared_ptr<BlackScholesLattice<T> >& lattice =
+                cached.lattice();
 
+            DiscretizedVanillaOption option(arguments_, *process_, grid);
 
+            option.initialize(lattice, maturity);
+            option.rollback(grid[0]);
+            va0 = option.values();
+            QL_ENSURE(va0.size() == tree->size(0),
+                      "Expect " << tree->size(0) << " nodes in grid at "
+                      "second step");
+        } else {
+            // European and American exercise: in-place rollback on a
+            // single buffer, without going through the lattice
+            Size firstExerciseStep = steps;
+            if (arguments_.exercise->type() == Exercise::American) {
+                Time earliest = process_->time(arguments_.exercise->date(0));
+                firstExerciseStep = 0;
+                while (firstExerciseStep < steps &&
+                       grid[firstExerciseStep] < earliest)
+                    ++firstExerciseStep;
+            }
+            DiscountFactor discount = std::exp(-r*(maturity/steps));
+            // with smoothing, the rollback starts from Black-Scholes
+            // values on the penultimate slice; the adaptive mesh takes
+            // their place when given
+            bool refined = (refinedSteps_ > 0);
+            bool smoothed = (smoothing_ != BinomialSmoothing_2::None &&
+                             !refined);
+            Size last = smoothed ? steps-1 : steps;
+            bool exercise = (last >= firstExerciseStep);
+            Time dt = maturity/steps;
 
-        // option values (p0) at this point
-        option.rollback(grid[0]);
-        Array va0(option.values());
-        QL_ENSURE(va0.size() == 3, "Expect 3 nodes in grid at second step");
-        Real p0u = va0[2]; // up
-        Real p0m = va0[1]; // mid
-        Real p0d = va0[0]; // down (low)
-        Real s0u = lattice->underlying(0, 2); // up price
-        Real s0m = lattice->underlying(0, 1); // middle price
-        Real s0d = lattice->underlying(0, 0); // down (low) price
+            if (arguments_.exercise->type() == Exercise::European &&
+                T::constantParameters && !refined && !valueSurface_ &&
+                tree->probability(0, 0, 0) > 0.0 &&
+                tree->probability(0, 0, 1) > 0.0) {
+                // no early exercise: sum over the last slice
+                if (smoothed) {
+                    const T& t = *tree;
+                    binomialExpectation_2(t, last, discount, *payoff,
+                        [&](Size j) {
+                            return blackScholesNodeValue_2(
+                                t, last, j, dt, r, q, v, *payoff, false);
+                        },
+                        va0);
+                } else {
+                    europeanVanilla_2(*tree, steps, discount, *payoff, va0);
+                }
+            } else if (T::constantParameters) {
+                // vectorized kernel, from the values on the last slice
+                const BinomialSlices_2& slices = cached.slices();
+                if (smoothed) {
+                    blackScholesSlice_2(*tree, last, dt, r, q, v, *payoff,
+                                        exercise, va0);
+                } else {
+                    Real omega =
+                        (payoff->optionType() == Option::Call ? 1.0 : -1.0);
+                    detail::binomialTerminalValues(slices, omega,
+                                                   payoff->strike(), va0);
+                }
+                if (refined) {
+                    refineNearStrike_2(slices, refinedSteps_, discount,
+                                       *payoff, firstExerciseStep,
+                                       r-q-0.5*v*v, v, dt,
+                                       refinementFactor_, va0);
+                    last = steps - refinedSteps_;
+                }
+
+                if (truncation_ != Null<Real>()) {
+                    // only the nodes close to the forward
+                    BinomialBand_2 band(slices, r-q-0.5*v*v, v, dt,
+                                        truncation_);
+                    const T& t = *tree;
+                    rollbackVanillaTruncated_2(slices, band, last, discount,
+                        *payoff, firstExerciseStep,
+                        [&](Size i, Size j) {
+                            return blackScholesNodeValue_2(
+                                t, i, j, maturity-i*dt, r, q, v, *payoff,
+                                i >= firstExerciseStep);
+                        },
+                        va0);
+                    Real forward =
+                        tree->underlying(0, spotLadder_)*
+                        std::exp((r-q)*maturity);
+                    truncationBound = binomialTruncationBound(
+                        steps, truncation_, forward, payoff->strike(),
+                        v, maturity);
+                } else if (exerciseBoundary_ &&
+                           arguments_.exercise->type() == Exercise::American) {
+                    // guessed from the last rollback on as many steps
+                    if (payoff->strike() != boundaryStrike_ ||
+                        payoff->optionType() != boundaryType_) {
+                        boundaries_.clear();
+                        boundaryStrike_ = payoff->strike();
+                        boundaryType_ = payoff->optionType();
+                    }
+                    std::vector<Real>& guess = boundaries_[steps];
+                    std::vector<Real> boundary;
+                    rollbackVanillaBoundary_2(slices, last, discount,
+                                              *payoff, firstExerciseStep,
+                                              va0, boundary, guess);
+                    guess.swap(boundary);
+                    std::vector<Time> times(steps+1);
+                    for (Size i=0; i<=steps; ++i)
+                        times[i] = i*dt;
+                    results_.additionalResults["exerciseBoundary"] = guess;
+                    results_.additionalResults["exerciseBoundaryTimes"] =
+                        times;
+                } else if (valueSurface_ &&
+                           (arguments_.exercise->type() ==
+                                                      Exercise::European ||
+                            firstExerciseStep == 0)) {
+                    // kept for the next requests
+                    rollbackVanillaSurface_2(slices, last, discount,
+                                             *payoff, firstExerciseStep,
+                                             va0, surfaceKey(market, *payoff),
+                                             *valueSurface_);
+                } else if (pool_) {
+                    rollbackVanillaFrom_2(slices, last, discount, *payoff,
+                                          firstExerciseStep, va0, *pool_);
+                } else {
+                    rollbackVanillaFrom_2(slices, last, discount, *payoff,
+                                          firstExerciseStep, va0);
+                }
+            } else {
+                if (smoothed) {
+                    blackScholesSlice_2(*tree, last, dt, r, q, v, *payoff,
+                                        exercise, va0);
+                    rollbackVanillaFrom_2(*tree, last, discount, *payoff,
+                                          firstExerciseStep, va0);
+                } else {
+                    va0 = Array(tree->size(steps));
+                    rollbackVanilla_2(*tree, steps, discount, *payoff,
+                                      firstExerciseStep, va0);
+                }
+            }
+        }
+        Size m = spotLadder_;
+        Real p0u = va0[m+1]; // up
+        Real p0m = va0[m]; // mid
+        Real p0d = va0[m-1]; // down (low)
+        Real s0u = tree->underlying(0, m+1); // up price
+        Real s0m = tree->underlying(0, m); // middle price
+        Real s0d = tree->underlying(0, m-1); // down (low) price
+
+        if (m > 1) {
+            // the whole initial slice
+            std::vector<Real> spots(2*m+1), ladder(2*m+1);
+            for (Size j=0; j<=2*m; ++j) {
+                spots[j] = tree->underlying(0, j);
+                ladder[j] = va0[j];
+            }
+            results_.additionalResults["spotLadder"] = spots;
+            results_.additionalResults["spotLadderValues"] = ladder;
+        }
 
         // calculate gamma by taking the first derivate of the two deltas
         /* Real delta0u = (p0u - p0m)/(s0u-s0m);
@@ -178,14 +970,351 @@ namespace QuantLib {
         option.rollback(0.0);
         Real p0 = option.presentValue();
 */
-        // Store results
-        results_.value = p0m;
-        results_.delta = delta0;
-        results_.gamma = gamma0;
+        value = p0m;
+        delta = delta0;
+        gamma = gamma0;
+    }
+
+
+    template <class T>
+    void BinomialVanillaEngine_2<T>::calculateScenarios(
+                  const detail::BinomialMarket_2& market,
+                  const boost::shared_ptr<PlainVanillaPayoff>& payoff) const {
+
+        Size steps = timeSteps_;
+        Time maturity = market.maturity;
+        Volatility dv = volatilityBump_;
+        Rate dr = rateBump_;
+
+        // base, volatility up and down, rate up and down, dividend
+        // yield up and down
+        const Size scenarios = 7;
+        detail::BinomialMarket_2 markets[scenarios] = {
+            market,
+            market.shifted(0.0, 0.0, dv), market.shifted(0.0, 0.0, -dv),
+            market.shifted(dr, 0.0, 0.0), market.shifted(-dr, 0.0, 0.0),
+            market.shifted(0.0, dr, 0.0), market.shifted(0.0, -dr, 0.0)
+        };
+
+        std::vector<boost::shared_ptr<T> > trees;
+        std::vector<BinomialSlices_2> slices;
+        std::vector<DiscountFactor> discounts;
+        bool closedForm = (arguments_.exercise->type() == Exercise::European);
+        for (Size k=0; k<scenarios; ++k) {
+            typename detail::BinomialTreeCache_2<T>::Entry& cached =
+                trees_.entry(markets[k], steps, payoff->strike());
+            const boost::shared_ptr<T>& tree = cached.tree();
+            closedForm = closedForm &&
+                tree->probability(0, 0, 0) > 0.0 &&
+                tree->probability(0, 0, 1) > 0.0;
+            trees.push_back(tree);
+            slices.push_back(cached.slices());
+            discounts.push_back(
+                std::exp(-markets[k].riskFreeRate*(maturity/steps)));
+        }
+
+        // option values at the three nodes at t=0, one column per
+        // scenario
+        Matrix va0;
+        if (closedForm) {
+            va0 = Matrix(trees[0]->size(0), scenarios);
+            Array column;
+            for (Size k=0; k<scenarios; ++k) {
+                europeanVanilla_2(*trees[k], steps, discounts[k], *payoff,
+                                  column);
+                for (Size j=0; j<column.size(); ++j)
+                    va0[j][k] = column[j];
+            }
+        } else {
+            Size firstExerciseStep = steps;
+            if (arguments_.exercise->type() == Exercise::American) {
+                TimeGrid grid(maturity, steps);
+                Time earliest = process_->time(arguments_.exercise->date(0));
+                firstExerciseStep = 0;
+                while (firstExerciseStep < steps &&
+                       grid[firstExerciseStep] < earliest)
+                    ++firstExerciseStep;
+            }
+            rollbackVanillaScenarios_2(BinomialScenarioSlices_2(slices),
+                                       discounts, *payoff,
+                                       firstExerciseStep, va0);
+        }
+
+        Size m = spotLadder_;
+        Real s0u = trees[0]->underlying(0, m+1); // up price
+        Real s0m = trees[0]->underlying(0, m); // middle price
+        Real s0d = trees[0]->underlying(0, m-1); // down (low) price
+        Real h2 = s0u - s0m;
+        Real h1 = s0m - s0d;
+        Real f0 = va0[m-1][0];
+        Real f1 = va0[m][0];
+        Real f2 = va0[m+1][0];
+
+        results_.value = f1;
+        results_.gamma = 2*(h2*f0 - (h1+h2)*f1 + h1*f2)/((h1*h2)*(h1+h2));
+        results_.delta = (-h2/(h1*(h1+h2)))*f0 - ((h1-h2)/(h1*h2))*f1
+                       + (h1/(h2*(h1+h2)))*f2;
+        results_.theta = blackScholesTheta(process_,
+                                           results_.value,
+                                           results_.delta,
+                                           results_.gamma);
+        results_.vega = (va0[m][1] - va0[m][2])/(2.0*dv);
+        results_.rho = (va0[m][3] - va0[m][4])/(2.0*dr);
+        results_.dividendRho = (va0[m][5] - va0[m][6])/(2.0*dr);
+    }
+
+
+    template <class T>
+    void BinomialVanillaEngine_2<T>::calculateAdjoint(
+                  const detail::BinomialMarket_2& market,
+                  const boost::shared_ptr<PlainVanillaPayoff>& payoff) const {
+
+        Size steps = timeSteps_;
+        Time maturity = market.maturity;
+
+        const T& tree =
+            *trees_.entry(market, steps, payoff->strike()).tree();
+
+        Size firstExerciseStep = steps;
+        if (arguments_.exercise->type() == Exercise::American) {
+            TimeGrid grid(maturity, steps);
+            Time earliest = process_->time(arguments_.exercise->date(0));
+            firstExerciseStep = 0;
+            while (firstExerciseStep < steps &&
+                   grid[firstExerciseStep] < earliest)
+                ++firstExerciseStep;
+        }
+
+        // option values at the three nodes at t=0
+        Array va0;
+        BinomialSensitivities_2 sensitivities =
+            binomialSensitivities_2(tree, steps, process_->x0(),
+                                    market.riskFreeRate,
+                                    market.dividendYield,
+                                    market.volatility, maturity,
+                                    market.dividendTimes,
+                                    market.dividendAmounts, *payoff,
+                                    firstExerciseStep, va0);
+
+        Size m = spotLadder_;
+        Real s0u = tree.underlying(0, m+1); // up price
+        Real s0m = tree.underlying(0, m); // middle price
+        Real s0d = tree.underlying(0, m-1); // down (low) price
+        Real h2 = s0u - s0m;
+        Real h1 = s0m - s0d;
+        Real f0 = va0[m-1];
+        Real f1 = va0[m];
+        Real f2 = va0[m+1];
+
+        results_.value = f1;
+        results_.gamma = 2*(h2*f0 - (h1+h2)*f1 + h1*f2)/((h1*h2)*(h1+h2));
+        results_.delta = (-h2/(h1*(h1+h2)))*f0 - ((h1-h2)/(h1*h2))*f1
+                       + (h1/(h2*(h1+h2)))*f2;
+        results_.theta = blackScholesTheta(process_,
+                                           results_.value,
+                                           results_.delta,
+                                           results_.gamma);
+        results_.vega = sensitivities.volatility;
+        results_.rho = sensitivities.riskFreeRate;
+        results_.dividendRho = sensitivities.dividendYield;
+        results_.additionalResults["spotSensitivity"] = sensitivities.spot;
+        results_.additionalResults["strikeSensitivity"] =
+            sensitivities.strike;
+        results_.additionalResults["maturitySensitivity"] =
+            sensitivities.maturity;
+    }
+
+
+    template <class T>
+    void BinomialVanillaEngine_2<T>::calculateAnytime(
+                  std::chrono::steady_clock::time_point start,
+                  const detail::BinomialMarket_2& market,
+                  const boost::shared_ptr<PlainVanillaPayoff>& payoff) const {
+
+        typedef std::chrono::duration<double> seconds;
+
+        Size steps = timeSteps_;
+        Real value, delta, gamma, truncationBound;
+        calculate(steps, market, payoff,
+                  value, delta, gamma, truncationBound);
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        Time elapsed = seconds(now - start).count();
+        Time lastCost = elapsed, previousCost = Null<Real>();
+
+        Real error = Null<Real>(), extrapolated = Null<Real>();
+        while (2*steps <= maxSteps_ &&
+               (targetError_ == Null<Real>() || error == Null<Real>() ||
+                error > targetError_)) {
+            if (timeBudget_ != Null<Real>()) {
+                // the cost grows between linearly (European options)
+                // and quadratically (rollbacks) with the steps; take
+                // the observed growth, or the worst case until known
+                Real growth = 4.0;
+                if (previousCost != Null<Real>() && previousCost > 0.0)
+                    growth = std::min(std::max(lastCost/previousCost, 2.0),
+                                      4.0);
+                if (elapsed + growth*lastCost > timeBudget_)
+                    break;
+            }
+
+            Real value2, delta2, gamma2, truncationBound2;
+            calculate(2*steps, market, payoff,
+                      value2, delta2, gamma2, truncationBound2);
+            std::chrono::steady_clock::time_point then = now;
+            now = std::chrono::steady_clock::now();
+            previousCost = lastCost;
+            lastCost = seconds(now - then).count();
+            elapsed = seconds(now - start).count();
+
+            // O(1/N) error: f(N) - f(2N) ~ f(2N) - f(inf)
+            error = std::fabs(value2 - value);
+            extrapolated = 2.0*value2 - value;
+            steps *= 2;
+            value = value2;
+            delta = delta2;
+            gamma = gamma2;
+            truncationBound = truncationBound2;
+        }
+
+        results_.additionalResults["timeSteps"] = steps;
+        if (error != Null<Real>()) {
+            results_.additionalResults["estimatedError"] = error;
+            results_.additionalResults["extrapolatedValue"] = extrapolated;
+        }
+        if (truncationBound > 0.0)
+            results_.additionalResults["truncationBound"] = truncationBound;
+
+        results_.value = value;
+        results_.delta = delta;
+        results_.gamma = gamma;
         results_.theta = blackScholesTheta(process_,
                                            results_.value,
                                            results_.delta,
-                                           results_.gamma);                                      
+                                           results_.gamma);
+    }
+
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>::MakeBinomialVanillaEngine_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process)
+    : process_(process), steps_(Null<Size>()) {}
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withSteps(Size steps) {
+        steps_ = steps;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withDividends(
+                                          const DividendSchedule& dividends) {
+        dividends_ = dividends;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withThreadPool(
+                                  const boost::shared_ptr<ThreadPool_2>& pool) {
+        pool_ = pool;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withSmoothing(
+                                         BinomialSmoothing_2::Type smoothing) {
+        settings_.smoothing = smoothing;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withTruncation(Real deviations) {
+        settings_.truncation = deviations;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withAdaptiveMesh(Size refinedSteps,
+                                                     Size factor) {
+        settings_.refinedSteps = refinedSteps;
+        settings_.refinementFactor = factor;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withScenarioGreeks(
+                                              Volatility volatilityBump,
+                                              Rate rateBump) {
+        settings_.volatilityBump = volatilityBump;
+        settings_.rateBump = rateBump;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withAdjointGreeks(bool b) {
+        settings_.adjointGreeks = b;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withSpotLadder(Size m) {
+        settings_.spotLadder = m;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withTimeBudget(Time seconds) {
+        settings_.timeBudget = seconds;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withTargetError(Real error) {
+        settings_.targetError = error;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withMaxSteps(Size steps) {
+        settings_.maxSteps = steps;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withExerciseBoundary(bool b) {
+        settings_.exerciseBoundary = b;
+        return *this;
+    }
+
+    template <class T>
+    inline MakeBinomialVanillaEngine_2<T>&
+    MakeBinomialVanillaEngine_2<T>::withValueSurface(
+                    const boost::shared_ptr<BinomialValueSurface_2>& surface) {
+        settings_.valueSurface = surface;
+        return *this;
+    }
+
+    template <class T>
+    inline
+    MakeBinomialVanillaEngine_2<T>::operator boost::shared_ptr<PricingEngine>()
+                                                                      const {
+        QL_REQUIRE(steps_ != Null<Size>(), "number of steps not given");
+        return boost::shared_ptr<PricingEngine>(new
+            BinomialVanillaEngine_2<T>(process_, steps_, dividends_, pool_,
+                                       settings_));
     }
 
 }
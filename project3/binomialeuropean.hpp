@@ -0,0 +1,151 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialeuropean.hpp
+    \brief Closed-form European values on binomial trees
+*/
+
+#ifndef binomial_european_hpp
+#define binomial_european_hpp
+
+#include <ql/instruments/payoffs.hpp>
+#include <ql/math/array.hpp>
+#include <ql/math/distributions/binomialdistribution.hpp>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Expectation over a slice of a constant-parameter tree
+    /*! When the branch probabilities are the same on every slice,
+        the value at initial node j of an option whose values on
+        slice i are known and which cannot be exercised before is
+        the discounted expectation
+        \f[
+            d^i \sum_{m=0}^i \binom{i}{m} p_u^m p_d^{i-m} \, f(j+m)
+        \f]
+        over the nodes of that slice, so that no rollback is needed.
+        \c sliceValues(k) must return the option value at node k of
+        slice i, and must be bounded by the larger of the node price
+        and the strike of \c payoff, as for plain calls and puts.
+
+        The binomial weights are obtained from the log-gamma function
+        at the mode of the distribution and by recursion away from
+        it; the sum stops on either side once the weight times the
+        above bound falls below \c accuracy times the scale of the
+        problem.  Only a few standard deviations of nodes are
+        visited, i.e., O(sqrt(i)) of them.
+
+        On return, \c values holds the tree.size(0) initial values.
+
+        \ingroup lattices
+    */
+    template <class T, class F>
+    void binomialExpectation_2(const T& tree,
+                               Size i,
+                               DiscountFactor discount,
+                               const PlainVanillaPayoff& payoff,
+                               const F& sliceValues,
+                               Array& values,
+                               Real accuracy = 1.0e-16) {
+        QL_REQUIRE(T::constantParameters,
+                   "tree with constant parameters required");
+        Real pu = tree.probability(0, 0, 1);
+        Real pd = tree.probability(0, 0, 0);
+        QL_REQUIRE(pu > 0.0 && pd > 0.0,
+                   "invalid branch probabilities (" << pu << ", "
+                   << pd << ")");
+
+        Real strike = payoff.strike();
+        Size nodes = tree.size(0);
+        Real scale = tree.underlying(0, nodes/2) + strike;
+
+        // weights, walking outwards from the mode
+        Size mode = std::min<Size>(Size((i+1)*pu), i);
+        Real modeWeight = std::exp(binomialCoefficientLn(i, mode)
+                                   + mode*std::log(pu)
+                                   + (i-mode)*std::log(pd));
+        Real ratio = pu/pd;
+
+        std::vector<Real> above(1, modeWeight);
+        Real w = modeWeight;
+        for (Size m=mode+1; m<=i; ++m) {
+            w *= ratio*Real(i-m+1)/Real(m);
+            above.push_back(w);
+            // values reached from m are bounded by the top node
+            // (calls) or by the strike (puts)
+            Real bound = std::max(tree.underlying(i, m+nodes-1), strike);
+            if (w*bound < accuracy*scale)
+                break;
+        }
+        std::vector<Real> below;
+        w = modeWeight;
+        for (Size m=mode; m>0; --m) {
+            w *= Real(m)/(ratio*Real(i-m+1));
+            below.push_back(w);
+            Real bound = std::max(tree.underlying(i, m+nodes-2), strike);
+            if (w*bound < accuracy*scale)
+                break;
+        }
+
+        // weights[k] is the one of m = first+k
+        Size first = mode - below.size();
+        std::vector<Real> weights(below.rbegin(), below.rend());
+        weights.insert(weights.end(), above.begin(), above.end());
+
+        // values on the nodes reached from any initial one
+        std::vector<Real> reached(weights.size() + nodes - 1);
+        for (Size k=0; k<reached.size(); ++k)
+            reached[k] = sliceValues(first+k);
+
+        DiscountFactor totalDiscount = std::pow(discount, Real(i));
+        values = Array(nodes, 0.0);
+        for (Size j=0; j<nodes; ++j) {
+            Real sum = 0.0;
+            for (Size k=0; k<weights.size(); ++k)
+                sum += weights[k]*reached[k+j];
+            values[j] = sum*totalDiscount;
+        }
+    }
+
+
+    //! European values at the initial nodes of a constant-parameter tree
+    /*! The expectation above, taken over the payoff on the terminal
+        slice.
+
+        \ingroup lattices
+    */
+    template <class T>
+    void europeanVanilla_2(const T& tree,
+                           Size steps,
+                           DiscountFactor discount,
+                           const PlainVanillaPayoff& payoff,
+                           Array& values,
+                           Real accuracy = 1.0e-16) {
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        binomialExpectation_2(tree, steps, discount, payoff,
+                              [&](Size k) {
+                                  return std::max(omega*(tree.underlying(
+                                      steps, k)-strike), 0.0);
+                              },
+                              values, accuracy);
+    }
+
+}
+
+
+#endif
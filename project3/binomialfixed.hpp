@@ -0,0 +1,173 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialfixed.hpp
+    \brief Binomial trees with a number of steps fixed at compile time
+*/
+
+#ifndef binomial_fixed_hpp
+#define binomial_fixed_hpp
+
+#include "binomialdirect.hpp"
+#include <array>
+
+namespace QuantLib {
+
+    //! Constant-parameter tree of type T with N steps, on the stack
+    /*! The tree is built from plain inputs through
+        BinomialTreeParameters_2<T>, as in binomialPrice_2, with three
+        initial nodes.  The node prices on slice i are base(i)*q^j;
+        the bases and the powers q^j are kept in std::arrays sized
+        at compile time, the latter padded for the rollback kernels.
+
+        Both are computed by repeated multiplication instead of one
+        exponential per node, which would cost as much as the
+        rollback itself on small trees; the node prices thus differ
+        from the ones of the other trees in the last few bits.
+
+        \ingroup lattices
+    */
+    template <class T, Size N>
+    class FixedBinomialTree_2 {
+      public:
+        enum { constantParameters = 1 };
+        //! number of steps
+        static const Size steps = N;
+        //! number of nodes on the last slice
+        static const Size nodes = N + 3;
+        //! number of nodes, padding included, of the rollback buffer
+        static const Size bufferSize = nodes + detail::binomialPadding;
+        typedef std::array<Real, bufferSize> Buffer;
+
+        explicit FixedBinomialTree_2(const BinomialOptionInputs_2& inputs) {
+            detail::binomialDirectParameters<T>(inputs, N, pu_, a_, b_, c_);
+            Real q = std::exp(c_), growth = std::exp(b_);
+            powers_[0] = 1.0;
+            for (Size j=1; j<nodes; ++j)
+                powers_[j] = powers_[j-1]*q;
+            for (Size j=nodes; j<bufferSize; ++j)
+                powers_[j] = 0.0;
+            bases_[0] = inputs.spot*std::exp(a_);
+            for (Size i=1; i<=N; ++i)
+                bases_[i] = bases_[i-1]*growth;
+        }
+        Size size(Size i) const { return i+3; }
+        Real underlying(Size i, Size index) const {
+            return bases_[i]*powers_[index];
+        }
+        Real probability(Size, Size, Size branch) const {
+            return branch == 1 ? pu_ : 1.0-pu_;
+        }
+        //! node price at the bottom of slice i
+        Real base(Size i) const { return bases_[i]; }
+        //! powers q^j, padded with zeros
+        const Buffer& powers() const { return powers_; }
+        //! coefficients of log S_{i,j} = log x0 + a + b i + c j
+        Real a() const { return a_; }
+        Real b() const { return b_; }
+        Real c() const { return c_; }
+      private:
+        Real pu_, a_, b_, c_;
+        std::array<Real, N+1> bases_;
+        Buffer powers_;
+    };
+
+
+    //! In-place backward induction on a fixed-size tree
+    /*! Same as rollbackVanilla_2, on a buffer sized at compile time
+        and with compile-time loop bounds; the slices go through the
+        same vectorized kernels.  On return the first three elements
+        of \c values hold the values at the initial nodes.
+
+        \ingroup lattices
+    */
+    template <class T, Size N>
+    void rollbackVanillaFixed_2(
+                      const FixedBinomialTree_2<T, N>& tree,
+                      DiscountFactor discount,
+                      const PlainVanillaPayoff& payoff,
+                      Size firstExerciseStep,
+                      typename FixedBinomialTree_2<T, N>::Buffer& values) {
+        typedef FixedBinomialTree_2<T, N> Tree;
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        const Real* powers = tree.powers().data();
+
+        Real lastBase = tree.base(N);
+        for (Size j=0; j<Tree::nodes; ++j)
+            values[j] = std::max(omega*(lastBase*powers[j] - strike), 0.0);
+        for (Size j=Tree::nodes; j<Tree::bufferSize; ++j)
+            values[j] = 0.0;
+
+        Real pu = tree.probability(0, 0, 1), pd = tree.probability(0, 0, 0);
+        for (Size i=N; i-- > 0; ) {
+            detail::BinomialExercise_2 exercise = {
+                tree.base(i), 0.0, omega, strike, powers
+            };
+            detail::binomialStep(values.data(), i+3, pu, pd, discount,
+                                 i >= firstExerciseStep ? &exercise : 0);
+        }
+    }
+
+
+    //! Value and Greeks of a vanilla option on a fixed-size tree
+    /*! Same as binomialPrice_2 on a FixedBinomialTree_2<T, N>: the
+        tree and the rollback buffer live in std::arrays on the
+        stack, so that no workspace is needed, and American options
+        are rolled back with rollbackVanillaFixed_2.  European
+        options are summed over the last slice as in
+        binomialPrice_2.  The number of steps in the inputs must be
+        N.
+
+        \ingroup vanillaengines
+    */
+    template <class T, Size N>
+    BinomialOptionResult_2 binomialPrice_2(
+                                     const BinomialOptionInputs_2& inputs) {
+        detail::binomialCheckInputs(inputs);
+        QL_REQUIRE(inputs.steps == N,
+                   inputs.steps << " steps given on a tree with " << N);
+        DiscountFactor discount =
+            std::exp(-inputs.riskFreeRate*(inputs.maturity/N));
+        if (inputs.exercise == Exercise::European) {
+            Real pu, a, b, c;
+            detail::binomialDirectParameters<T>(inputs, N, pu, a, b, c);
+            if (pu > 0.0 && pu < 1.0) {
+                // no need for the tree
+                Real omega = (inputs.type == Option::Call ? 1.0 : -1.0);
+                Real f[3];
+                detail::binomialEuropeanDirect(inputs.spot, a, b, c, pu, N,
+                                               discount, omega,
+                                               inputs.strike, f);
+                return detail::binomialDirectResult(inputs, a, c, f);
+            }
+        }
+        FixedBinomialTree_2<T, N> tree(inputs);
+        PlainVanillaPayoff payoff(inputs.type, inputs.strike);
+        Size firstExerciseStep =
+            (inputs.exercise == Exercise::American ? 0 : N);
+        typename FixedBinomialTree_2<T, N>::Buffer values;
+        rollbackVanillaFixed_2(tree, discount, payoff, firstExerciseStep,
+                               values);
+        return detail::binomialDirectResult(inputs, tree.a(), tree.c(),
+                                            values.data());
+    }
+
+}
+
+
+#endif
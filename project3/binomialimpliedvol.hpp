@@ -0,0 +1,329 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialimpliedvol.hpp
+    \brief Implied volatilities of batches of quotes on binomial trees
+*/
+
+#ifndef binomial_implied_vol_hpp
+#define binomial_implied_vol_hpp
+
+#include "binomialengine.hpp"
+#include <ql/pricingengines/blackformula.hpp>
+#include <atomic>
+#include <map>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        /* A constant-parameter tree of type T on a flat market, built
+           from BinomialTreeParameters_2<T> instead of a process.  The
+           escrowed spot and the dividend adjustments do not depend on
+           the volatility and are computed once; setVolatility() only
+           recomputes the branch probability and the node spacing.
+           It provides what BinomialSlices_2 and
+           binomialSensitivities_2 need, and nothing else. */
+        template <class T>
+        class BinomialParametricTree_2 {
+          public:
+            enum { constantParameters = 1 };
+            BinomialParametricTree_2(Real escrowedSpot, Rate r, Rate q,
+                                     Time maturity, Size steps,
+                                     Real strike,
+                                     const std::vector<Time>& dividendTimes,
+                                     const std::vector<Real>& dividendAmounts)
+            : x0_(escrowedSpot), r_(r), q_(q), strike_(strike),
+              steps_(BinomialTreeParameters_2<T>::steps(steps)),
+              dt_(maturity/steps_), adjustment_(steps_+1, 0.0) {
+                for (Size i=0; i<=steps_; ++i) {
+                    Time t = i*dt_;
+                    for (Size k=0; k<dividendTimes.size(); ++k) {
+                        if (dividendTimes[k] > t)
+                            adjustment_[i] += dividendAmounts[k] *
+                                std::exp(-r*(dividendTimes[k]-t));
+                    }
+                }
+            }
+            void setVolatility(Volatility v) {
+                Real drift = (r_ - q_ - 0.5*v*v)*dt_;
+                BinomialTreeParameters_2<T>::compute(x0_, drift, v*v*dt_,
+                                                     steps_, strike_,
+                                                     pu_, a_, b_, c_);
+            }
+            Size size(Size i) const { return i+3; }
+            Size initialWidth() const { return 1; }
+            Real underlying(Size i, Size index) const {
+                return x0_*std::exp(a_ + b_*i + c_*index) + adjustment_[i];
+            }
+            Real probability(Size, Size, Size branch) const {
+                return branch == 1 ? pu_ : 1.0-pu_;
+            }
+            Real dividendAdjustment(Size i) const { return adjustment_[i]; }
+          private:
+            Real x0_;
+            Rate r_, q_;
+            Real strike_;
+            Size steps_;
+            Time dt_;
+            std::vector<Real> adjustment_;
+            Real pu_, a_, b_, c_;
+        };
+
+    }
+
+    template <class T>
+    struct BinomialTreeParameters_2<detail::BinomialParametricTree_2<T> >
+        : BinomialTreeParameters_2<T> {};
+
+
+    //! Implied volatilities of vanilla quotes on a binomial tree
+    /*! Each quote is inverted with Newton steps on the tree value,
+        using the exact derivative of the latter with respect to the
+        volatility from binomialSensitivities_2, i.e., the same vega
+        as BinomialVanillaEngine_2 with adjoint Greeks; a step
+        leaving the bracket of volatilities known to be too low and
+        too high is replaced by a bisection.  The first guess is the
+        Black volatility implied by the quote as if the option were
+        European, or 20% if there is none.
+
+        The flattened market of each expiry is built once per call
+        to calculate(); the trees are rebuilt from their parameters
+        at each iteration without going through a process (see
+        detail::BinomialParametricTree_2), so that the cost of an
+        iteration is essentially the one of the adjoint rollback.
+        If a thread pool is given, quotes are solved concurrently,
+        each thread taking the next unsolved quote as it becomes
+        free.
+
+        Iterations stop when the next Newton step would be smaller
+        than the given accuracy.  Quotes which cannot be matched
+        within the volatility bounds or the maximum number of
+        evaluations get a null implied volatility instead of
+        throwing, so that one bad quote does not spoil the batch.
+
+        As in the engine, the tree must have constant parameters and
+        Bermudan exercise is not supported.
+
+        \ingroup vanillaengines
+    */
+    template <class T>
+    class BinomialImpliedVolatility_2 {
+      public:
+        BinomialImpliedVolatility_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             Size timeSteps,
+             const DividendSchedule& dividends = DividendSchedule(),
+             const boost::shared_ptr<ThreadPool_2>& pool =
+                                          boost::shared_ptr<ThreadPool_2>(),
+             Real accuracy = 1.0e-4,
+             Size maxEvaluations = 100,
+             Volatility minVol = 1.0e-4,
+             Volatility maxVol = 4.0);
+        //! solves for the volatilities matching the given prices
+        void calculate(const std::vector<PlainVanillaPayoff>& payoffs,
+                       const std::vector<boost::shared_ptr<Exercise> >&
+                                                                   exercises,
+                       const std::vector<Real>& prices);
+        //! \name Results of the last calculation
+        //@{
+        Size size() const { return volatility_.size(); }
+        //! null if the quote could not be matched
+        Volatility impliedVolatility(Size k) const { return volatility_[k]; }
+        //! trees rolled back for the quote
+        Size evaluations(Size k) const { return evaluations_[k]; }
+        //@}
+      private:
+        struct Request {
+            const detail::BinomialMarket_2* market;
+            Real spot;
+            PlainVanillaPayoff payoff;
+            Size firstExerciseStep;
+            Real price;
+            Volatility guess;
+        };
+        void solve(const Request& quote, Volatility& volatility,
+                   Size& evaluations) const;
+        boost::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        Size timeSteps_;
+        DividendSchedule dividends_;
+        boost::shared_ptr<ThreadPool_2> pool_;
+        Real accuracy_;
+        Size maxEvaluations_;
+        Volatility minVol_, maxVol_;
+        std::vector<Volatility> volatility_;
+        std::vector<Size> evaluations_;
+    };
+
+
+    // template definitions
+
+    template <class T>
+    BinomialImpliedVolatility_2<T>::BinomialImpliedVolatility_2(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             Size timeSteps,
+             const DividendSchedule& dividends,
+             const boost::shared_ptr<ThreadPool_2>& pool,
+             Real accuracy,
+             Size maxEvaluations,
+             Volatility minVol,
+             Volatility maxVol)
+    : process_(process), timeSteps_(timeSteps), dividends_(dividends),
+      pool_(pool), accuracy_(accuracy), maxEvaluations_(maxEvaluations),
+      minVol_(minVol), maxVol_(maxVol) {
+        QL_REQUIRE(T::constantParameters,
+                   "tree with constant parameters required");
+        QL_REQUIRE(timeSteps >= 2,
+                   "at least 2 time steps required, "
+                   << timeSteps << " provided");
+        QL_REQUIRE(accuracy > 0.0,
+                   "positive accuracy required, " << accuracy << " provided");
+        QL_REQUIRE(maxEvaluations > 0, "null maximum evaluations given");
+        QL_REQUIRE(minVol > 0.0 && minVol < maxVol,
+                   "invalid volatility bounds [" << minVol << ", "
+                   << maxVol << "]");
+    }
+
+    template <class T>
+    void BinomialImpliedVolatility_2<T>::calculate(
+                const std::vector<PlainVanillaPayoff>& payoffs,
+                const std::vector<boost::shared_ptr<Exercise> >& exercises,
+                const std::vector<Real>& prices) {
+        Size count = payoffs.size();
+        QL_REQUIRE(exercises.size() == count && prices.size() == count,
+                   count << " payoffs but " << exercises.size()
+                   << " exercises and " << prices.size()
+                   << " prices given");
+
+        // flattened markets, one per expiry, and first guesses; the
+        // process is only used here, on the calling thread
+        std::map<Date, boost::shared_ptr<detail::BinomialMarket_2> > markets;
+        std::vector<Request> quotes;
+        quotes.reserve(count);
+        Real spot = process_->x0();
+        for (Size k=0; k<count; ++k) {
+            const boost::shared_ptr<Exercise>& exercise = exercises[k];
+            QL_REQUIRE(exercise->type() != Exercise::Bermudan,
+                       "Bermudan exercise not supported");
+            Date maturityDate = exercise->lastDate();
+            boost::shared_ptr<detail::BinomialMarket_2>& market =
+                markets[maturityDate];
+            if (!market)
+                market = boost::shared_ptr<detail::BinomialMarket_2>(
+                    new detail::BinomialMarket_2(process_, dividends_,
+                                                 maturityDate));
+            Time maturity = market->maturity;
+
+            Size firstExerciseStep = timeSteps_;
+            if (exercise->type() == Exercise::American) {
+                TimeGrid grid(maturity, timeSteps_);
+                Time earliest = process_->time(exercise->date(0));
+                firstExerciseStep = 0;
+                while (firstExerciseStep < timeSteps_ &&
+                       grid[firstExerciseStep] < earliest)
+                    ++firstExerciseStep;
+            }
+
+            Volatility guess = 0.2;
+            try {
+                DiscountFactor discount =
+                    std::exp(-market->riskFreeRate*maturity);
+                Real forward = market->escrowedSpot*std::exp(
+                    (market->riskFreeRate-market->dividendYield)*maturity);
+                guess = blackFormulaImpliedStdDev(payoffs[k].optionType(),
+                                                  payoffs[k].strike(),
+                                                  forward, prices[k],
+                                                  discount)
+                    / std::sqrt(maturity);
+            } catch (std::exception&) {
+                // e.g., an American price above the European bounds
+            }
+            if (!(guess > minVol_ && guess < maxVol_))
+                guess = 0.2;
+
+            Request quote = { market.get(), spot, payoffs[k],
+                              firstExerciseStep, prices[k], guess };
+            quotes.push_back(quote);
+        }
+
+        volatility_.resize(count);
+        evaluations_.resize(count);
+        if (pool_ && pool_->size() > 1 && count > 1) {
+            std::atomic<Size> next(0);
+            pool_->run(pool_->size(), [&](Size) {
+                for (Size k = next++; k < count; k = next++)
+                    solve(quotes[k], volatility_[k], evaluations_[k]);
+            });
+        } else {
+            for (Size k=0; k<count; ++k)
+                solve(quotes[k], volatility_[k], evaluations_[k]);
+        }
+    }
+
+    template <class T>
+    void BinomialImpliedVolatility_2<T>::solve(const Request& quote,
+                                               Volatility& volatility,
+                                               Size& evaluations) const {
+        const detail::BinomialMarket_2& market = *quote.market;
+        detail::BinomialParametricTree_2<T> tree(
+            market.escrowedSpot, market.riskFreeRate, market.dividendYield,
+            market.maturity, timeSteps_, quote.payoff.strike(),
+            market.dividendTimes, market.dividendAmounts);
+        Array values;
+
+        // the tree value increases with the volatility: lo and hi
+        // bracket the solution as long as the quote is attainable
+        Volatility lo = minVol_, hi = maxVol_, v = quote.guess;
+        volatility = Null<Real>();
+        evaluations = 0;
+        while (evaluations < maxEvaluations_) {
+            tree.setVolatility(v);
+            BinomialSensitivities_2 sensitivities =
+                binomialSensitivities_2(tree, timeSteps_, quote.spot,
+                                        market.riskFreeRate,
+                                        market.dividendYield, v,
+                                        market.maturity,
+                                        market.dividendTimes,
+                                        market.dividendAmounts,
+                                        quote.payoff,
+                                        quote.firstExerciseStep, values);
+            ++evaluations;
+            Real error = values[1] - quote.price;
+            Real vega = sensitivities.volatility;
+            if (vega > 0.0 && std::fabs(error) < accuracy_*vega) {
+                volatility = v;
+                return;
+            }
+            if (error < 0.0)
+                lo = v;
+            else
+                hi = v;
+            if (hi - lo < accuracy_) {
+                // cornered against a bound: the quote is out of reach
+                if (lo > minVol_ && hi < maxVol_)
+                    volatility = v;
+                return;
+            }
+            Volatility next = (vega > 0.0 ? v - error/vega : Null<Real>());
+            v = (next > lo && next < hi) ? next : 0.5*(lo+hi);
+        }
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,266 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialportfolio.hpp
+    \brief Vanilla options priced concurrently on binomial trees
+*/
+
+#ifndef binomial_portfolio_hpp
+#define binomial_portfolio_hpp
+
+#include "binomialengine.hpp"
+#include <algorithm>
+#include <map>
+
+namespace QuantLib {
+
+    //! Batch of vanilla options priced concurrently on binomial trees
+    /*! Options are added with the process, and possibly the
+        dividends, they are to be priced with, as they would be
+        given to BinomialVanillaEngine_2; calculate() then prices all
+        of them and returns value, delta, gamma and theta in the
+        order of insertion, as the engine would.
+
+        QuantLib objects cannot be used from several threads at
+        once: the evaluation date is global, and term structures,
+        processes and instruments update lazily and notify their
+        observers.  The batch is thus priced in two phases.  On the
+        calling thread, the arguments of each option are read, the
+        market is flattened once per process, dividends and expiry
+        (see detail::BinomialMarket_2), and the trees and their
+        slices are built once per market (and strike, for trees
+        depending on it); the evaluation date and all market data
+        are fixed from then on.  The options are then rolled back on
+        the threads of the pool, each with its own context holding
+        its buffers, through ThreadPool_2::forEach; the workers only
+        read the prepared trees and never touch a QuantLib object.
+        Thetas are computed on the calling thread at the end.
+
+        Without a pool, or with a single thread, the same work is
+        done serially.  As in the engine, the tree must have
+        constant parameters and Bermudan exercise is not supported;
+        none of the engine options (smoothing, truncation, and so
+        on) are available.
+
+        \ingroup vanillaengines
+    */
+    template <class T>
+    class BinomialPortfolio_2 {
+      public:
+        BinomialPortfolio_2(Size timeSteps,
+                            const boost::shared_ptr<ThreadPool_2>& pool =
+                                          boost::shared_ptr<ThreadPool_2>());
+        //! adds an option to the batch and returns its index
+        Size add(const boost::shared_ptr<VanillaOption>& option,
+                 const boost::shared_ptr<GeneralizedBlackScholesProcess>&
+                                                                     process,
+                 const DividendSchedule& dividends = DividendSchedule());
+        //! prices all the options added so far
+        void calculate();
+        //! \name Results of the last calculation
+        //@{
+        Size size() const { return value_.size(); }
+        Real value(Size k) const { return value_[k]; }
+        Real delta(Size k) const { return delta_[k]; }
+        Real gamma(Size k) const { return gamma_[k]; }
+        Real theta(Size k) const { return theta_[k]; }
+        //@}
+      private:
+        struct Position {
+            boost::shared_ptr<VanillaOption> option;
+            boost::shared_ptr<GeneralizedBlackScholesProcess> process;
+            DividendSchedule dividends;
+        };
+        // everything a worker needs to price a position
+        struct Job {
+            boost::shared_ptr<T> tree;
+            boost::shared_ptr<BinomialSlices_2> slices;
+            PlainVanillaPayoff payoff;
+            DiscountFactor discount;
+            Size firstExerciseStep;
+            bool closedForm;
+        };
+        // per-thread state
+        struct Context {
+            Array values;
+        };
+        Size timeSteps_;
+        boost::shared_ptr<ThreadPool_2> pool_;
+        std::vector<Position> positions_;
+        std::vector<Real> value_, delta_, gamma_, theta_;
+    };
+
+
+    // template definitions
+
+    template <class T>
+    BinomialPortfolio_2<T>::BinomialPortfolio_2(
+                                  Size timeSteps,
+                                  const boost::shared_ptr<ThreadPool_2>& pool)
+    : timeSteps_(timeSteps), pool_(pool) {
+        QL_REQUIRE(T::constantParameters,
+                   "tree with constant parameters required");
+        QL_REQUIRE(timeSteps >= 2,
+                   "at least 2 time steps required, "
+                   << timeSteps << " provided");
+    }
+
+    template <class T>
+    Size BinomialPortfolio_2<T>::add(
+             const boost::shared_ptr<VanillaOption>& option,
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const DividendSchedule& dividends) {
+        QL_REQUIRE(option, "null option given");
+        QL_REQUIRE(process, "null process given");
+        Position position = { option, process, dividends };
+        positions_.push_back(position);
+        return positions_.size()-1;
+    }
+
+    template <class T>
+    void BinomialPortfolio_2<T>::calculate() {
+        Size count = positions_.size();
+
+        // first phase, on this thread: markets, trees and slices
+        typedef std::pair<const GeneralizedBlackScholesProcess*, Date>
+                                                                  MarketKey;
+        std::vector<std::pair<MarketKey, DividendSchedule> > marketKeys;
+        std::vector<boost::shared_ptr<detail::BinomialMarket_2> > markets;
+        std::map<std::pair<Size, Real>, Size> treeIndex;
+        std::vector<Job> jobs;
+        jobs.reserve(count);
+        VanillaOption::arguments arguments;
+        for (Size k=0; k<count; ++k) {
+            const Position& position = positions_[k];
+            position.option->setupArguments(&arguments);
+            arguments.validate();
+            boost::shared_ptr<PlainVanillaPayoff> payoff =
+                boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                                                          arguments.payoff);
+            QL_REQUIRE(payoff, "non-plain payoff given for option " << k);
+            const boost::shared_ptr<Exercise>& exercise = arguments.exercise;
+            QL_REQUIRE(exercise->type() != Exercise::Bermudan,
+                       "Bermudan exercise not supported");
+
+            // flattened market, shared with the same process,
+            // dividends and expiry
+            std::pair<MarketKey, DividendSchedule> key(
+                MarketKey(position.process.get(), exercise->lastDate()),
+                position.dividends);
+            Size m = std::find(marketKeys.begin(), marketKeys.end(), key)
+                   - marketKeys.begin();
+            if (m == marketKeys.size()) {
+                marketKeys.push_back(key);
+                markets.push_back(boost::shared_ptr<detail::BinomialMarket_2>(
+                    new detail::BinomialMarket_2(position.process,
+                                                 position.dividends,
+                                                 exercise->lastDate())));
+            }
+            const detail::BinomialMarket_2& market = *markets[m];
+
+            // tree, shared with the same market (and strike)
+            Real strikeKey =
+                T::strikeIndependent ? Null<Real>() : payoff->strike();
+            std::pair<Size, Real> treeKey(m, strikeKey);
+            boost::shared_ptr<T> tree;
+            boost::shared_ptr<BinomialSlices_2> slices;
+            typename std::map<std::pair<Size, Real>, Size>::const_iterator
+                found = treeIndex.find(treeKey);
+            if (found != treeIndex.end()) {
+                tree = jobs[found->second].tree;
+                slices = jobs[found->second].slices;
+            } else {
+                tree = boost::shared_ptr<T>(new T(market.process,
+                                                  market.maturity,
+                                                  timeSteps_,
+                                                  payoff->strike()));
+                if (!market.dividendTimes.empty())
+                    tree->setDividends(market.dividendTimes,
+                                       market.dividendAmounts,
+                                       market.riskFreeRate);
+                slices = boost::shared_ptr<BinomialSlices_2>(
+                                   new BinomialSlices_2(*tree, timeSteps_));
+                treeIndex[treeKey] = k;
+            }
+
+            Size firstExerciseStep = timeSteps_;
+            if (exercise->type() == Exercise::American) {
+                TimeGrid grid(market.maturity, timeSteps_);
+                Time earliest = position.process->time(exercise->date(0));
+                firstExerciseStep = 0;
+                while (firstExerciseStep < timeSteps_ &&
+                       grid[firstExerciseStep] < earliest)
+                    ++firstExerciseStep;
+            }
+            Job job = {
+                tree, slices, *payoff,
+                std::exp(-market.riskFreeRate*(market.maturity/timeSteps_)),
+                firstExerciseStep,
+                exercise->type() == Exercise::European &&
+                    tree->probability(0, 0, 0) > 0.0 &&
+                    tree->probability(0, 0, 1) > 0.0
+            };
+            jobs.push_back(job);
+        }
+
+        // second phase, on the workers: rollbacks only
+        value_.resize(count);
+        delta_.resize(count);
+        gamma_.resize(count);
+        theta_.resize(count);
+        Size threads = pool_ ? pool_->size() : 1;
+        std::vector<Context> contexts(threads);
+        auto price = [&](Size p, Size k) {
+            const Job& job = jobs[k];
+            Array& va0 = contexts[p].values;
+            if (job.closedForm)
+                europeanVanilla_2(*job.tree, timeSteps_, job.discount,
+                                  job.payoff, va0);
+            else
+                rollbackVanilla_2(*job.slices, job.discount, job.payoff,
+                                  job.firstExerciseStep, va0);
+
+            Real s0u = job.tree->underlying(0, 2); // up price
+            Real s0m = job.tree->underlying(0, 1); // middle price
+            Real s0d = job.tree->underlying(0, 0); // down (low) price
+            Real h2 = s0u - s0m;
+            Real h1 = s0m - s0d;
+            Real f0 = va0[0];
+            Real f1 = va0[1];
+            Real f2 = va0[2];
+            value_[k] = f1;
+            gamma_[k] = 2*(h2*f0 - (h1+h2)*f1 + h1*f2)/((h1*h2)*(h1+h2));
+            delta_[k] = (-h2/(h1*(h1+h2)))*f0 - ((h1-h2)/(h1*h2))*f1
+                      + (h1/(h2*(h1+h2)))*f2;
+        };
+        if (threads > 1) {
+            pool_->forEach(count, price);
+        } else {
+            for (Size k=0; k<count; ++k)
+                price(0, k);
+        }
+
+        // back on this thread
+        for (Size k=0; k<count; ++k)
+            theta_[k] = blackScholesTheta(positions_[k].process, value_[k],
+                                          delta_[k], gamma_[k]);
+    }
+
+}
+
+
+#endif
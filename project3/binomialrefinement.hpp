@@ -0,0 +1,147 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialrefinement.hpp
+    \brief Adaptive mesh refinement near the strike
+*/
+
+#ifndef binomial_refinement_hpp
+#define binomial_refinement_hpp
+
+#include "binomialrollback.hpp"
+#include <cmath>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        /* Cox-Ross-Rubinstein lattice rooted at a single node of
+           slice s of a coarse tree, with price spacing refined by a
+           given factor and therefore time steps refined by its
+           square.  The dividend adjustment on each fine slice is the
+           one of the coarse slice it falls in. */
+        class BinomialSubLattice_2 {
+          public:
+            enum Parameters { constantParameters = 1 };
+            BinomialSubLattice_2(const BinomialSlices_2& coarse, Size s,
+                                 Size subSteps, Real spot, Real dx, Real pu)
+            : coarse_(coarse), s_(s), subSteps_(subSteps), spot_(spot),
+              dx_(dx), pu_(pu) {}
+            Size size(Size i) const { return i+1; }
+            Real underlying(Size i, Size index) const {
+                return spot_*std::exp((2.0*Real(index) - Real(i))*dx_)
+                    + dividendAdjustment(i);
+            }
+            Real probability(Size, Size, Size branch) const {
+                return (branch == 1 ? pu_ : 1.0-pu_);
+            }
+            Real dividendAdjustment(Size i) const {
+                return coarse_.shift(s_ + i/subSteps_);
+            }
+          private:
+            const BinomialSlices_2& coarse_;
+            Size s_, subSteps_;
+            Real spot_, dx_, pu_;
+        };
+
+    }
+
+
+    //! Adaptive mesh refinement near the strike
+    /*! The payoff is only kinked at the strike, and the coarse tree
+        resolves it poorly over the last few steps.  On entry,
+        \c values holds the terminal values, as set up for
+        rollbackVanillaFrom_2; they are rolled back on the coarse
+        tree through the last \c refinedSteps slices.  Then the
+        values at the nodes of slice s = steps-refinedSteps within
+        \c width standard deviations (over the remaining time) of the
+        strike are recomputed on a Cox-Ross-Rubinstein sub-lattice
+        rooted at each of them, with a price spacing \c factor times
+        finer than the coarse tree and \c factor squared times as many
+        time steps (see Figlewski and Gao, "The adaptive mesh model",
+        1999.)
+
+        On return \c values holds the values on slice s, followed by
+        detail::binomialPadding zeros, ready for rollbackVanillaFrom_2
+        or rollbackVanillaTruncated_2 from slice s.
+
+        The error of the coarse tree becomes smooth in the number of
+        steps instead of oscillating with the position of the strike
+        between the nodes, which makes it suitable for Richardson
+        extrapolation.
+
+        \ingroup lattices
+    */
+    inline void refineNearStrike_2(const BinomialSlices_2& slices,
+                                   Size refinedSteps,
+                                   DiscountFactor discount,
+                                   const PlainVanillaPayoff& payoff,
+                                   Size firstExerciseStep,
+                                   Real drift, Volatility volatility,
+                                   Time dt, Size factor,
+                                   Array& values,
+                                   Real width = 4.0) {
+        Size steps = slices.steps();
+        QL_REQUIRE(refinedSteps > 0 && refinedSteps < steps,
+                   "between 1 and " << steps-1 << " refined steps "
+                   "required, " << refinedSteps << " given");
+        QL_REQUIRE(factor > 1, "refinement factor must be at least 2");
+        QL_REQUIRE(values.size() >= slices.size(steps)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(steps)+detail::binomialPadding
+                   << " elements required");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        // coarse rollback over the refined window
+        Size s = steps - refinedSteps;
+        detail::binomialAdvance(values.begin(), 0, slices.size(s), steps,
+                                refinedSteps, slices, discount, omega,
+                                strike, firstExerciseStep);
+        std::fill(values.begin()+slices.size(s), values.end(), 0.0);
+
+        // fine sub-lattices
+        Size subSteps = factor*factor;
+        Size fineSteps = refinedSteps*subSteps;
+        Time fineDt = dt/subSteps;
+        Real fineDx = volatility*std::sqrt(fineDt);
+        Real finePu = 0.5 + 0.5*drift*fineDt/fineDx;
+        QL_REQUIRE(finePu > 0.0 && finePu < 1.0,
+                   "negative probability on the refined lattice");
+        DiscountFactor fineDiscount = std::pow(discount, 1.0/subSteps);
+        Size fineExerciseStep = firstExerciseStep <= s ? 0 :
+            std::min((firstExerciseStep-s)*subSteps, fineSteps);
+        Real halfWidth = width*volatility*std::sqrt(refinedSteps*dt);
+
+        Array fineValues;
+        for (Size j=0; j<slices.size(s); ++j) {
+            Real spot = slices.base(s)*slices.powers()[j];
+            if (std::fabs(std::log((spot+slices.shift(s))/strike)) > halfWidth)
+                continue;
+            detail::BinomialSubLattice_2 lattice(slices, s, subSteps, spot,
+                                                 fineDx, finePu);
+            BinomialSlices_2 fine(lattice, fineSteps);
+            rollbackVanilla_2(fine, fineDiscount, payoff, fineExerciseStep,
+                              fineValues);
+            values[j] = fineValues[0];
+        }
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,630 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialrollback.hpp
+    \brief In-place rollback of vanilla payoffs on binomial trees
+*/
+
+#ifndef binomial_rollback_hpp
+#define binomial_rollback_hpp
+
+#include "threadpool.hpp"
+#include <ql/instruments/payoffs.hpp>
+#include <ql/math/array.hpp>
+#include <cmath>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define QL_BINOMIAL_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace QuantLib {
+
+    namespace detail {
+
+        /* The vectorized kernels always work on whole registers, so
+           they may read and write up to binomialPadding-1 elements
+           past the end of a slice; buffers must be allocated with
+           that much room to spare. */
+        const Size binomialPadding = 8;
+
+        /* Kernels rolling back several values per node store them
+           contiguously, one lane each, so that a node fills exactly
+           one AVX-512 register (or two AVX2 ones.) */
+        const Size binomialLanes = 8;
+
+        // exercise values on a slice: omega*(base*powers[j]+shift-strike)
+        struct BinomialExercise_2 {
+            Real base, shift, omega, strike;
+            const Real* powers;
+        };
+
+        // v[j] = max((pd*v[j]+pu*v[j+1])*disc, exercise[j]) for j<n;
+        // values[j+1] is still the one at the later slice when v[j]
+        // is overwritten, so the update runs in place
+        inline void binomialStepScalar(Real* v, Size n, Real pu, Real pd,
+                                       DiscountFactor disc,
+                                       const BinomialExercise_2* ex) {
+            if (ex) {
+                for (Size j=0; j<n; ++j) {
+                    Real continuation = (pd*v[j] + pu*v[j+1])*disc;
+                    Real exercise =
+                        ex->omega*(ex->base*ex->powers[j] + ex->shift
+                                   - ex->strike);
+                    v[j] = std::max(continuation, exercise);
+                }
+            } else {
+                for (Size j=0; j<n; ++j)
+                    v[j] = (pd*v[j] + pu*v[j+1])*disc;
+            }
+        }
+
+        #if defined(QL_BINOMIAL_X86_SIMD)
+
+        // same sequence of multiplications and additions as the
+        // scalar kernel, on four or eight nodes at a time
+
+        __attribute__((target("avx2")))
+        inline void binomialStepAvx2(Real* v, Size n, Real pu, Real pd,
+                                     DiscountFactor disc,
+                                     const BinomialExercise_2* ex) {
+            const __m256d vpu = _mm256_set1_pd(pu);
+            const __m256d vpd = _mm256_set1_pd(pd);
+            const __m256d vdisc = _mm256_set1_pd(disc);
+            if (ex) {
+                const __m256d vbase = _mm256_set1_pd(ex->base);
+                const __m256d vshift = _mm256_set1_pd(ex->shift);
+                const __m256d vomega = _mm256_set1_pd(ex->omega);
+                const __m256d vstrike = _mm256_set1_pd(ex->strike);
+                for (Size j=0; j<n; j+=4) {
+                    __m256d c = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(v+j)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(v+j+1))),
+                        vdisc);
+                    __m256d s = _mm256_add_pd(
+                        _mm256_mul_pd(vbase, _mm256_loadu_pd(ex->powers+j)),
+                        vshift);
+                    __m256d e = _mm256_mul_pd(vomega,
+                                              _mm256_sub_pd(s, vstrike));
+                    _mm256_storeu_pd(v+j, _mm256_max_pd(c, e));
+                }
+            } else {
+                for (Size j=0; j<n; j+=4) {
+                    __m256d c = _mm256_mul_pd(
+                        _mm256_add_pd(
+                            _mm256_mul_pd(vpd, _mm256_loadu_pd(v+j)),
+                            _mm256_mul_pd(vpu, _mm256_loadu_pd(v+j+1))),
+                        vdisc);
+                    _mm256_storeu_pd(v+j, c);
+                }
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline void binomialStepAvx512(Real* v, Size n, Real pu, Real pd,
+                                       DiscountFactor disc,
+                                       const BinomialExercise_2* ex) {
+            const __m512d vpu = _mm512_set1_pd(pu);
+            const __m512d vpd = _mm512_set1_pd(pd);
+            const __m512d vdisc = _mm512_set1_pd(disc);
+            if (ex) {
+                const __m512d vbase = _mm512_set1_pd(ex->base);
+                const __m512d vshift = _mm512_set1_pd(ex->shift);
+                const __m512d vomega = _mm512_set1_pd(ex->omega);
+                const __m512d vstrike = _mm512_set1_pd(ex->strike);
+                for (Size j=0; j<n; j+=8) {
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(v+j)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(v+j+1))),
+                        vdisc);
+                    __m512d s = _mm512_add_pd(
+                        _mm512_mul_pd(vbase, _mm512_loadu_pd(ex->powers+j)),
+                        vshift);
+                    __m512d e = _mm512_mul_pd(vomega,
+                                              _mm512_sub_pd(s, vstrike));
+                    _mm512_storeu_pd(v+j, _mm512_max_pd(c, e));
+                }
+            } else {
+                for (Size j=0; j<n; j+=8) {
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(v+j)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(v+j+1))),
+                        vdisc);
+                    _mm512_storeu_pd(v+j, c);
+                }
+            }
+        }
+
+        #endif
+
+        typedef void (*BinomialStep_2)(Real*, Size, Real, Real,
+                                       DiscountFactor,
+                                       const BinomialExercise_2*);
+
+        inline BinomialStep_2 selectBinomialStep() {
+            #if defined(QL_BINOMIAL_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return &binomialStepAvx512;
+            if (__builtin_cpu_supports("avx2"))
+                return &binomialStepAvx2;
+            #endif
+            return &binomialStepScalar;
+        }
+
+        // the instruction set is detected once, at the first call
+        inline void binomialStep(Real* v, Size n, Real pu, Real pd,
+                                 DiscountFactor disc,
+                                 const BinomialExercise_2* ex) {
+            static const BinomialStep_2 step = selectBinomialStep();
+            step(v, n, pu, pd, disc, ex);
+        }
+
+        inline const char* binomialStepInstructionSet() {
+            BinomialStep_2 step = selectBinomialStep();
+            #if defined(QL_BINOMIAL_X86_SIMD)
+            if (step == &binomialStepAvx512)
+                return "AVX-512";
+            if (step == &binomialStepAvx2)
+                return "AVX2";
+            #endif
+            return "scalar";
+        }
+
+    }
+
+
+    //! Slice-by-slice description of a constant-parameter binomial tree
+    /*! On trees with constant parameters the (escrowed) node prices
+        on slice i are base(i)*q^(j-c), with the same ratio q on every
+        slice, and the branch probabilities do not depend on the
+        node.  The powers q^(j-c) are taken once from the last slice,
+        so that the rollback kernels can evaluate exercise values
+        with a multiplication instead of calling back into the tree.
+
+        The anchor c is the middle node of the last slice, so that
+        the powers span half the range of the node prices either
+        way; taken from the bottom node, they would overflow on
+        large trees (e.g., when sigma*sqrt(T*N) exceeds about 350.)
+
+        \ingroup lattices
+    */
+    class BinomialSlices_2 {
+      public:
+        template <class T>
+        BinomialSlices_2(const T& tree, Size steps)
+        : steps_(steps), initialSize_(tree.size(0)),
+          anchor_((tree.size(steps)-1)/2),
+          powers_(tree.size(steps)+detail::binomialPadding, 0.0),
+          base_(steps+1), shift_(steps+1), pu_(steps+1), pd_(steps+1) {
+            QL_REQUIRE(T::constantParameters,
+                       "tree with constant parameters required");
+            Size last = tree.size(steps);
+            Real lastShift = tree.dividendAdjustment(steps);
+            Real anchorPrice = tree.underlying(steps, anchor_) - lastShift;
+            for (Size j=0; j<last; ++j) {
+                powers_[j] = (tree.underlying(steps, j) - lastShift)
+                           / anchorPrice;
+                QL_ENSURE(std::isfinite(powers_[j]) && powers_[j] > 0.0,
+                          "node price ratio " << powers_[j] << " at node "
+                          << j << " of slice " << steps);
+            }
+            ratio_ = (anchor_+1 < last ? powers_[anchor_+1]
+                                       : 1.0/powers_[anchor_-1]);
+            for (Size i=0; i<=steps; ++i) {
+                // from the middle node, whose price is within range
+                Size middle = (tree.size(i)-1)/2;
+                shift_[i] = tree.dividendAdjustment(i);
+                base_[i] = (tree.underlying(i, middle) - shift_[i])
+                         / powers_[middle];
+                pd_[i] = tree.probability(i, 0, 0);
+                pu_[i] = tree.probability(i, 0, 1);
+            }
+        }
+        Size steps() const { return steps_; }
+        Size size(Size i) const { return initialSize_ + i; }
+        Real underlying(Size i, Size index) const {
+            return base_[i]*powers_[index] + shift_[i];
+        }
+        //! price at node c of the slice, net of the shift
+        Real base(Size i) const { return base_[i]; }
+        Real shift(Size i) const { return shift_[i]; }
+        Real pu(Size i) const { return pu_[i]; }
+        Real pd(Size i) const { return pd_[i]; }
+        //! q^(j-c), padded for the vectorized kernels
+        const Real* powers() const { return &powers_[0]; }
+        //! the anchor c, i.e., the node with unit power
+        Size anchor() const { return anchor_; }
+        //! the ratio q between the prices of neighbouring nodes
+        Real ratio() const { return ratio_; }
+      private:
+        Size steps_, initialSize_, anchor_;
+        Real ratio_;
+        std::vector<Real> powers_, base_, shift_, pu_, pd_;
+    };
+
+
+    //! In-place backward induction from a given slice
+    /*! On entry, \c values holds the option values on slice
+        \c from.  It is overwritten slice by slice down to t=0; on
+        return its first tree.size(0) elements hold the values at
+        the initial nodes.  No memory is allocated during the
+        rollback.
+
+        Early exercise is checked at every slice from
+        \c firstExerciseStep onwards; passing \c from gives a
+        European option.  The payoff is only used for this check.
+
+        \ingroup lattices
+    */
+    template <class T>
+    void rollbackVanillaFrom_2(const T& tree,
+                               Size from,
+                               DiscountFactor discount,
+                               const PlainVanillaPayoff& payoff,
+                               Size firstExerciseStep,
+                               Array& values) {
+        QL_REQUIRE(values.size() >= tree.size(from),
+                   "buffer of size " << values.size() << " given, at least "
+                   << tree.size(from) << " nodes required");
+
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        for (Size i=from; i-- > 0; ) {
+            Real pd = tree.probability(i, 0, 0);
+            Real pu = tree.probability(i, 0, 1);
+            Size n = tree.size(i);
+            // values[j+1] is still the one at slice i+1 when values[j]
+            // is overwritten, so the update can run in place
+            if (i >= firstExerciseStep) {
+                for (Size j=0; j<n; ++j) {
+                    Real continuation = (pd*values[j] + pu*values[j+1])*discount;
+                    Real exercise = omega*(tree.underlying(i, j)-strike);
+                    values[j] = std::max(continuation, exercise);
+                }
+            } else {
+                for (Size j=0; j<n; ++j)
+                    values[j] = (pd*values[j] + pu*values[j+1])*discount;
+            }
+        }
+    }
+
+
+    //! In-place backward induction of a plain-vanilla payoff
+    /*! The buffer, which must hold the tree.size(steps) terminal
+        nodes, is initialized with the payoff at maturity and rolled
+        back to t=0 as in rollbackVanillaFrom_2.  Passing \c steps
+        as \c firstExerciseStep gives a European option.
+
+        \ingroup lattices
+    */
+    template <class T>
+    void rollbackVanilla_2(const T& tree,
+                           Size steps,
+                           DiscountFactor discount,
+                           const PlainVanillaPayoff& payoff,
+                           Size firstExerciseStep,
+                           Array& values) {
+        QL_REQUIRE(values.size() >= tree.size(steps),
+                   "buffer of size " << values.size() << " given, at least "
+                   << tree.size(steps) << " nodes required");
+
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        for (Size j=0; j<tree.size(steps); ++j)
+            values[j] = std::max(omega*(tree.underlying(steps, j)-strike),
+                                 0.0);
+
+        rollbackVanillaFrom_2(tree, steps, discount, payoff,
+                              firstExerciseStep, values);
+    }
+
+
+    namespace detail {
+
+        // terminal payoff on the last slice; the padding is zeroed
+        inline void binomialTerminalValues(const BinomialSlices_2& slices,
+                                           Real omega, Real strike,
+                                           Array& values) {
+            Size steps = slices.steps();
+            Size nodes = slices.size(steps);
+            if (values.size() < nodes + binomialPadding)
+                values = Array(nodes + binomialPadding);
+            for (Size j=0; j<nodes; ++j)
+                values[j] = std::max(
+                    omega*(slices.underlying(steps, j)-strike), 0.0);
+            for (Size j=nodes; j<values.size(); ++j)
+                values[j] = 0.0;
+        }
+
+        /* Rolls nodes [first, first+n) back from slice i to slice i-k.
+           On entry v holds the values at slice i of nodes
+           [first, first+n+k), i.e., everything they depend on; on
+           exit its first n elements hold their values at slice i-k.
+           Each step loses one node at the top, so the ones past n
+           are overwritten with intermediate results. */
+        inline void binomialAdvance(Real* v, Size first, Size n,
+                                    Size i, Size k,
+                                    const BinomialSlices_2& slices,
+                                    DiscountFactor discount,
+                                    Real omega, Real strike,
+                                    Size firstExerciseStep) {
+            BinomialExercise_2 exercise = {
+                0.0, 0.0, omega, strike, slices.powers() + first
+            };
+            for (Size s=1; s<=k; ++s) {
+                Size slice = i-s;
+                if (slice >= firstExerciseStep) {
+                    exercise.base = slices.base(slice);
+                    exercise.shift = slices.shift(slice);
+                    binomialStep(v, n+k-s, slices.pu(slice),
+                                 slices.pd(slice), discount, &exercise);
+                } else {
+                    binomialStep(v, n+k-s, slices.pu(slice),
+                                 slices.pd(slice), discount, 0);
+                }
+            }
+        }
+
+        /* Same as binomialAdvance, but the range is processed in
+           tiles of the given width, left to right.  Each tile and the
+           k nodes above it are copied to the scratch buffer, which
+           should be small enough to stay in cache, and rolled back
+           there through all the k slices; only its first part is
+           copied back.  The nodes above a tile are still at slice i
+           when it is processed, since tiles to its right have not
+           been touched yet.  The k values above the range are taken
+           from ghost instead of v, which allows the caller to pass a
+           copy.  scratch must hold tileWidth+k+binomialPadding
+           elements. */
+        inline void binomialAdvanceTiled(Real* v, Size first, Size n,
+                                         const Real* ghost,
+                                         Size i, Size k,
+                                         const BinomialSlices_2& slices,
+                                         DiscountFactor discount,
+                                         Real omega, Real strike,
+                                         Size firstExerciseStep,
+                                         Size tileWidth, Real* scratch) {
+            for (Size a=0; a<n; a+=tileWidth) {
+                Size b = std::min(a+tileWidth, n);
+                Size inside = std::min(b+k, n);
+                std::copy(v+a, v+inside, scratch);
+                // only the tiles reaching past the range need the
+                // ghost values; for the others, the offsets would wrap
+                if (b+k > n)
+                    std::copy(ghost, ghost + (b+k-n), scratch + (n-a));
+                binomialAdvance(scratch, first+a, b-a, i, k, slices,
+                                discount, omega, strike, firstExerciseStep);
+                std::copy(scratch, scratch+(b-a), v+a);
+            }
+        }
+
+        // rolls the whole buffer back from slice i to slice to (by
+        // default, t=0), tiling while the slices are wider than the
+        // tiles
+        inline void binomialRollback(Real* v, Size i,
+                                     const BinomialSlices_2& slices,
+                                     DiscountFactor discount,
+                                     Real omega, Real strike,
+                                     Size firstExerciseStep,
+                                     Size blockSteps, Size tileWidth,
+                                     Size to = 0) {
+            if (tileWidth > 0 && slices.size(i) > tileWidth) {
+                std::vector<Real> scratch(tileWidth+blockSteps+
+                                          binomialPadding, 0.0);
+                while (i > to && slices.size(i) > tileWidth) {
+                    Size k = std::min(blockSteps, i-to);
+                    Size n = slices.size(i-k);
+                    binomialAdvanceTiled(v, 0, n, v+n, i, k, slices,
+                                         discount, omega, strike,
+                                         firstExerciseStep, tileWidth,
+                                         &scratch[0]);
+                    i -= k;
+                }
+            }
+            binomialAdvance(v, 0, slices.size(to), i, i-to, slices,
+                            discount, omega, strike, firstExerciseStep);
+        }
+
+    }
+
+
+    //! Vectorized in-place backward induction from a given slice
+    /*! Same as the above, but the inner loop, early-exercise
+        comparison included, runs on AVX2 or AVX-512 registers when
+        the processor supports them.  The instruction set is detected
+        at run time.  On entry, the values on slice \c from must be
+        followed by at least detail::binomialPadding zeros.
+
+        Once the slices are wider than \c tileWidth nodes, the
+        rollback is tiled in time as well as in space: tiles of
+        \c tileWidth nodes are rolled back through \c blockSteps
+        slices at a time while they sit in cache, so that the full
+        buffer is streamed from memory once per block instead of
+        once per slice.  A null tile width gives the plain slice by
+        slice loop.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaFrom_2(const BinomialSlices_2& slices,
+                                      Size from,
+                                      DiscountFactor discount,
+                                      const PlainVanillaPayoff& payoff,
+                                      Size firstExerciseStep,
+                                      Array& values,
+                                      Size blockSteps = 128,
+                                      Size tileWidth = 4096) {
+        QL_REQUIRE(blockSteps > 0, "null block size");
+        QL_REQUIRE(from <= slices.steps(),
+                   "slice " << from << " past the last one ("
+                   << slices.steps() << ")");
+        QL_REQUIRE(values.size() >= slices.size(from)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(from)+detail::binomialPadding
+                   << " elements required");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        detail::binomialRollback(values.begin(), from, slices,
+                                 discount, omega, strike, firstExerciseStep,
+                                 blockSteps, tileWidth);
+    }
+
+
+    //! Vectorized in-place backward induction on a constant-parameter tree
+    /*! The buffer is resized if it cannot hold the terminal slice
+        plus the padding needed by the kernels, initialized with the
+        payoff at maturity and rolled back as in the above.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanilla_2(const BinomialSlices_2& slices,
+                                  DiscountFactor discount,
+                                  const PlainVanillaPayoff& payoff,
+                                  Size firstExerciseStep,
+                                  Array& values,
+                                  Size blockSteps = 128,
+                                  Size tileWidth = 4096) {
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        detail::binomialTerminalValues(slices, omega, strike, values);
+        rollbackVanillaFrom_2(slices, slices.steps(), discount, payoff,
+                              firstExerciseStep, values, blockSteps,
+                              tileWidth);
+    }
+
+
+    //! Multithreaded in-place backward induction from a given slice
+    /*! The rollback proceeds in blocks of \c blockSteps slices.  At
+        the start of each block the nodes still needed at its end are
+        split in one contiguous chunk per thread; each thread saves
+        the few nodes above its chunk that the chunk depends on
+        within the block, then rolls its chunk back through the whole
+        block, tile by tile as in the serial version, without further
+        synchronization.  The nodes above each chunk are thus
+        computed twice, by two threads, in exchange for two barriers
+        per block instead of two per slice.
+
+        Every node goes through the same kernel, on the same inputs,
+        as in the serial rollback, so the results are identical to
+        the latter.  Once slices are narrower than \c minChunk nodes
+        per thread, the remaining slices are rolled back serially.
+
+        On entry, the values on slice \c from must be followed by at
+        least detail::binomialPadding zeros.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaFrom_2(const BinomialSlices_2& slices,
+                                      Size from,
+                                      DiscountFactor discount,
+                                      const PlainVanillaPayoff& payoff,
+                                      Size firstExerciseStep,
+                                      Array& values,
+                                      ThreadPool_2& pool,
+                                      Size blockSteps = 128,
+                                      Size tileWidth = 4096,
+                                      Size minChunk = 1024) {
+        QL_REQUIRE(blockSteps > 0, "null block size");
+        QL_REQUIRE(tileWidth > 0, "null tile width");
+        QL_REQUIRE(from <= slices.steps(),
+                   "slice " << from << " past the last one ("
+                   << slices.steps() << ")");
+        QL_REQUIRE(values.size() >= slices.size(from)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(from)+detail::binomialPadding
+                   << " elements required");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        Size threads = pool.size();
+        Real* v = values.begin();
+        Size remaining = from;
+
+        if (threads > 1) {
+            // per-thread buffers, allocated here: a thread throwing
+            // before the barrier would leave the others waiting
+            Size scratchSize = tileWidth+blockSteps+detail::binomialPadding;
+            std::vector<Real> ghosts(threads*blockSteps);
+            std::vector<Real> scratches(threads*scratchSize, 0.0);
+            SpinBarrier_2 barrier(threads);
+            pool.run(threads, [&](Size p) {
+                Real* ghost = &ghosts[p*blockSteps];
+                Real* scratch = &scratches[p*scratchSize];
+                Size i = from;
+                // all threads take the same decisions, so they leave
+                // the loop together
+                while (i > 0) {
+                    Size k = std::min(blockSteps, i);
+                    Size n = slices.size(i-k);
+                    if (n < threads*minChunk)
+                        break;
+                    Size first = p*n/threads, last = (p+1)*n/threads;
+                    std::copy(v+last, v+last+k, ghost);
+                    barrier.wait();
+                    detail::binomialAdvanceTiled(v+first, first, last-first,
+                                                 ghost, i, k, slices,
+                                                 discount, omega, strike,
+                                                 firstExerciseStep,
+                                                 tileWidth, scratch);
+                    barrier.wait();
+                    i -= k;
+                }
+                if (p == 0)
+                    remaining = i;
+            });
+        }
+
+        detail::binomialRollback(v, remaining, slices, discount, omega,
+                                 strike, firstExerciseStep, blockSteps,
+                                 tileWidth);
+    }
+
+
+    //! Multithreaded in-place backward induction
+    /*! The buffer is initialized with the payoff at maturity and
+        rolled back as in the above.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanilla_2(const BinomialSlices_2& slices,
+                                  DiscountFactor discount,
+                                  const PlainVanillaPayoff& payoff,
+                                  Size firstExerciseStep,
+                                  Array& values,
+                                  ThreadPool_2& pool,
+                                  Size blockSteps = 128,
+                                  Size tileWidth = 4096,
+                                  Size minChunk = 1024) {
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        detail::binomialTerminalValues(slices, omega, strike, values);
+        rollbackVanillaFrom_2(slices, slices.steps(), discount, payoff,
+                              firstExerciseStep, values, pool, blockSteps,
+                              tileWidth, minChunk);
+    }
+
+}
+
+
+#endif
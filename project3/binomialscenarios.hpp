@@ -0,0 +1,333 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialscenarios.hpp
+    \brief Market scenarios rolled back together on binomial trees
+*/
+
+#ifndef binomial_scenarios_hpp
+#define binomial_scenarios_hpp
+
+#include "binomialrollback.hpp"
+#include <ql/math/matrix.hpp>
+
+namespace QuantLib {
+
+    namespace detail {
+
+        // branch probabilities and discount factors of each lane on
+        // a slice
+        struct BinomialScenarioStep_2 {
+            const Real* pu;
+            const Real* pd;
+            const Real* discount;
+        };
+
+        // exercise values on a slice: for node j and lane k,
+        // omega*(base[k]*powers[j*lanes+k]+shift[k]-strike)
+        struct BinomialScenarioExercise_2 {
+            const Real* base;
+            const Real* shift;
+            const Real* powers;
+            Real omega, strike;
+        };
+
+        /* Each lane carries a different tree of the same size; the
+           values of node j on all lanes are contiguous, and rolled
+           back with the lane's own probabilities and discount.  As
+           for a single tree, node j+1 is still at the later slice
+           when node j is overwritten. */
+        inline void binomialScenarioStepScalar(
+                                    Real* v, Size n,
+                                    const BinomialScenarioStep_2& p,
+                                    const BinomialScenarioExercise_2* ex) {
+            for (Size j=0; j<n; ++j) {
+                Real* node = v + j*binomialLanes;
+                const Real* next = node + binomialLanes;
+                for (Size k=0; k<binomialLanes; ++k) {
+                    Real continuation =
+                        (p.pd[k]*node[k] + p.pu[k]*next[k])*p.discount[k];
+                    if (ex) {
+                        Real exercise =
+                            ex->omega*(ex->base[k]*ex->powers[j*binomialLanes+k]
+                                       + ex->shift[k] - ex->strike);
+                        node[k] = std::max(continuation, exercise);
+                    } else {
+                        node[k] = continuation;
+                    }
+                }
+            }
+        }
+
+        #if defined(QL_BINOMIAL_X86_SIMD)
+
+        __attribute__((target("avx2")))
+        inline void binomialScenarioStepAvx2(
+                                    Real* v, Size n,
+                                    const BinomialScenarioStep_2& p,
+                                    const BinomialScenarioExercise_2* ex) {
+            for (Size h=0; h<binomialLanes; h+=4) {
+                const __m256d vpu = _mm256_loadu_pd(p.pu+h);
+                const __m256d vpd = _mm256_loadu_pd(p.pd+h);
+                const __m256d vdisc = _mm256_loadu_pd(p.discount+h);
+                if (ex) {
+                    const __m256d vbase = _mm256_loadu_pd(ex->base+h);
+                    const __m256d vshift = _mm256_loadu_pd(ex->shift+h);
+                    const __m256d vomega = _mm256_set1_pd(ex->omega);
+                    const __m256d vstrike = _mm256_set1_pd(ex->strike);
+                    for (Size j=0; j<n; ++j) {
+                        Real* node = v + j*binomialLanes + h;
+                        __m256d c = _mm256_mul_pd(
+                            _mm256_add_pd(
+                                _mm256_mul_pd(vpd, _mm256_loadu_pd(node)),
+                                _mm256_mul_pd(vpu, _mm256_loadu_pd(
+                                                  node+binomialLanes))),
+                            vdisc);
+                        __m256d s = _mm256_add_pd(
+                            _mm256_mul_pd(vbase, _mm256_loadu_pd(
+                                ex->powers + j*binomialLanes + h)),
+                            vshift);
+                        __m256d e = _mm256_mul_pd(vomega,
+                                                  _mm256_sub_pd(s, vstrike));
+                        _mm256_storeu_pd(node, _mm256_max_pd(c, e));
+                    }
+                } else {
+                    for (Size j=0; j<n; ++j) {
+                        Real* node = v + j*binomialLanes + h;
+                        __m256d c = _mm256_mul_pd(
+                            _mm256_add_pd(
+                                _mm256_mul_pd(vpd, _mm256_loadu_pd(node)),
+                                _mm256_mul_pd(vpu, _mm256_loadu_pd(
+                                                  node+binomialLanes))),
+                            vdisc);
+                        _mm256_storeu_pd(node, c);
+                    }
+                }
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline void binomialScenarioStepAvx512(
+                                    Real* v, Size n,
+                                    const BinomialScenarioStep_2& p,
+                                    const BinomialScenarioExercise_2* ex) {
+            const __m512d vpu = _mm512_loadu_pd(p.pu);
+            const __m512d vpd = _mm512_loadu_pd(p.pd);
+            const __m512d vdisc = _mm512_loadu_pd(p.discount);
+            if (ex) {
+                const __m512d vbase = _mm512_loadu_pd(ex->base);
+                const __m512d vshift = _mm512_loadu_pd(ex->shift);
+                const __m512d vomega = _mm512_set1_pd(ex->omega);
+                const __m512d vstrike = _mm512_set1_pd(ex->strike);
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(node)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(
+                                              node+binomialLanes))),
+                        vdisc);
+                    __m512d s = _mm512_add_pd(
+                        _mm512_mul_pd(vbase, _mm512_loadu_pd(
+                                          ex->powers + j*binomialLanes)),
+                        vshift);
+                    __m512d e = _mm512_mul_pd(vomega,
+                                              _mm512_sub_pd(s, vstrike));
+                    _mm512_storeu_pd(node, _mm512_max_pd(c, e));
+                }
+            } else {
+                for (Size j=0; j<n; ++j) {
+                    Real* node = v + j*binomialLanes;
+                    __m512d c = _mm512_mul_pd(
+                        _mm512_add_pd(
+                            _mm512_mul_pd(vpd, _mm512_loadu_pd(node)),
+                            _mm512_mul_pd(vpu, _mm512_loadu_pd(
+                                              node+binomialLanes))),
+                        vdisc);
+                    _mm512_storeu_pd(node, c);
+                }
+            }
+        }
+
+        #endif
+
+        typedef void (*BinomialScenarioStepKernel_2)(
+                                        Real*, Size,
+                                        const BinomialScenarioStep_2&,
+                                        const BinomialScenarioExercise_2*);
+
+        inline BinomialScenarioStepKernel_2 selectBinomialScenarioStep() {
+            #if defined(QL_BINOMIAL_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return &binomialScenarioStepAvx512;
+            if (__builtin_cpu_supports("avx2"))
+                return &binomialScenarioStepAvx2;
+            #endif
+            return &binomialScenarioStepScalar;
+        }
+
+        inline void binomialScenarioStep(
+                                    Real* v, Size n,
+                                    const BinomialScenarioStep_2& p,
+                                    const BinomialScenarioExercise_2* ex) {
+            static const BinomialScenarioStepKernel_2 step =
+                selectBinomialScenarioStep();
+            step(v, n, p, ex);
+        }
+
+    }
+
+
+    //! Constant-parameter trees of the same size, one per lane
+    /*! Each scenario, e.g., a bumped volatility or rate, gives its own
+        tree; the slices of up to detail::binomialLanes of them are
+        interleaved so that their nodes can be rolled back together.
+        Unused lanes repeat the first scenario.
+
+        \ingroup lattices
+    */
+    class BinomialScenarioSlices_2 {
+      public:
+        BinomialScenarioSlices_2(
+                              const std::vector<BinomialSlices_2>& scenarios)
+        : scenarios_(scenarios.size()) {
+            const Size lanes = detail::binomialLanes;
+            QL_REQUIRE(!scenarios.empty() && scenarios.size() <= lanes,
+                       "between 1 and " << lanes << " scenarios required, "
+                       << scenarios.size() << " given");
+            steps_ = scenarios[0].steps();
+            initialSize_ = scenarios[0].size(0);
+            for (Size k=1; k<scenarios.size(); ++k)
+                QL_REQUIRE(scenarios[k].steps() == steps_ &&
+                           scenarios[k].size(0) == initialSize_,
+                           "scenario trees of different sizes given");
+            Size nodes = size(steps_);
+            powers_.resize((nodes+1)*lanes);
+            base_.resize((steps_+1)*lanes);
+            shift_.resize((steps_+1)*lanes);
+            pu_.resize((steps_+1)*lanes);
+            pd_.resize((steps_+1)*lanes);
+            for (Size k=0; k<lanes; ++k) {
+                const BinomialSlices_2& s =
+                    scenarios[k < scenarios.size() ? k : 0];
+                for (Size j=0; j<=nodes; ++j)
+                    powers_[j*lanes+k] = s.powers()[j];
+                for (Size i=0; i<=steps_; ++i) {
+                    base_[i*lanes+k] = s.base(i);
+                    shift_[i*lanes+k] = s.shift(i);
+                    pu_[i*lanes+k] = s.pu(i);
+                    pd_[i*lanes+k] = s.pd(i);
+                }
+            }
+        }
+        Size scenarios() const { return scenarios_; }
+        Size steps() const { return steps_; }
+        Size size(Size i) const { return initialSize_ + i; }
+        Real underlying(Size k, Size i, Size index) const {
+            const Size lanes = detail::binomialLanes;
+            return base_[i*lanes+k]*powers_[index*lanes+k]
+                + shift_[i*lanes+k];
+        }
+        //! \name Lane values on slice i
+        //@{
+        const Real* base(Size i) const {
+            return &base_[i*detail::binomialLanes];
+        }
+        const Real* shift(Size i) const {
+            return &shift_[i*detail::binomialLanes];
+        }
+        const Real* pu(Size i) const {
+            return &pu_[i*detail::binomialLanes];
+        }
+        const Real* pd(Size i) const {
+            return &pd_[i*detail::binomialLanes];
+        }
+        //@}
+        //! powers of each lane (see BinomialSlices_2), interleaved
+        const Real* powers() const { return &powers_[0]; }
+      private:
+        Size scenarios_, steps_, initialSize_;
+        std::vector<Real> powers_, base_, shift_, pu_, pd_;
+    };
+
+
+    //! Backward induction of one payoff under several scenarios
+    /*! The payoff is rolled back on all the scenario trees at once;
+        the inner loop runs across scenarios, with each lane using
+        its own branch probabilities, node prices and discount
+        factor from \c discounts.  Each lane performs the same
+        operations as rollbackVanilla_2 on its tree, so that the
+        results match those of separate rollbacks.
+
+        On return, \c values has one row per initial node and one
+        column per scenario.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaScenarios_2(
+                               const BinomialScenarioSlices_2& slices,
+                               const std::vector<DiscountFactor>& discounts,
+                               const PlainVanillaPayoff& payoff,
+                               Size firstExerciseStep,
+                               Matrix& values) {
+        const Size lanes = detail::binomialLanes;
+        QL_REQUIRE(discounts.size() == slices.scenarios(),
+                   discounts.size() << " discount factors given for "
+                   << slices.scenarios() << " scenarios");
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        Real strike = payoff.strike();
+
+        Real discount[lanes];
+        for (Size k=0; k<lanes; ++k)
+            discount[k] = discounts[k < discounts.size() ? k : 0];
+
+        Size steps = slices.steps();
+        Size nodes = slices.size(steps);
+        std::vector<Real> v((nodes+1)*lanes, 0.0);
+        for (Size j=0; j<nodes; ++j)
+            for (Size k=0; k<lanes; ++k)
+                v[j*lanes+k] = std::max(
+                    omega*(slices.underlying(k, steps, j) - strike), 0.0);
+
+        detail::BinomialScenarioExercise_2 exercise = {
+            0, 0, slices.powers(), omega, strike
+        };
+        for (Size i=steps; i-- > 0; ) {
+            detail::BinomialScenarioStep_2 step = {
+                slices.pu(i), slices.pd(i), discount
+            };
+            if (i >= firstExerciseStep) {
+                exercise.base = slices.base(i);
+                exercise.shift = slices.shift(i);
+                detail::binomialScenarioStep(&v[0], slices.size(i), step,
+                                             &exercise);
+            } else {
+                detail::binomialScenarioStep(&v[0], slices.size(i), step, 0);
+            }
+        }
+
+        values = Matrix(slices.size(0), slices.scenarios());
+        for (Size j=0; j<slices.size(0); ++j)
+            for (Size k=0; k<slices.scenarios(); ++k)
+                values[j][k] = v[j*lanes+k];
+    }
+
+}
+
+
+#endif
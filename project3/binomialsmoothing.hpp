@@ -0,0 +1,94 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialsmoothing.hpp
+    \brief Black-Scholes smoothing of binomial trees
+*/
+
+#ifndef binomial_smoothing_hpp
+#define binomial_smoothing_hpp
+
+#include "binomialrollback.hpp"
+#include <ql/pricingengines/blackformula.hpp>
+
+namespace QuantLib {
+
+    //! Smoothing of binomial prices
+    /*! The raw N-step price oscillates with the position of the
+        strike between the terminal nodes.  Replacing the values on
+        the penultimate slice with Black-Scholes prices (BBS, see
+        Broadie and Detemple, 1996) removes the kink of the payoff
+        from the tree and makes the convergence smooth, roughly as
+        1/N; the leading error term can then be removed by Richardson
+        extrapolation from N and N/2 steps (BBSR).
+    */
+    struct BinomialSmoothing_2 {
+        enum Type {
+            None,          //!< raw tree
+            BlackScholes,  //!< Black-Scholes values on the penultimate slice
+            Richardson     //!< BBS on N and N/2 steps, extrapolated
+        };
+    };
+
+
+    //! Black-Scholes value at a node of a binomial tree
+    /*! Value at node j of slice i of a European option expiring after
+        \c timeToMaturity.  With escrowed dividends, the lognormal
+        part of the node price is the one net of the dividend
+        adjustment.  If \c exercise is true, the value is floored by
+        the exercise value at the node.
+    */
+    template <class T>
+    Real blackScholesNodeValue_2(const T& tree, Size i, Size j,
+                                 Time timeToMaturity,
+                                 Rate r, Rate q, Volatility v,
+                                 const PlainVanillaPayoff& payoff,
+                                 bool exercise) {
+        Real s = tree.underlying(i, j);
+        Real forward = (s - tree.dividendAdjustment(i))
+                     * std::exp((r-q)*timeToMaturity);
+        Real value = blackFormula(payoff.optionType(), payoff.strike(),
+                                  forward, v*std::sqrt(timeToMaturity),
+                                  std::exp(-r*timeToMaturity));
+        if (exercise)
+            value = std::max(value, payoff(s));
+        return value;
+    }
+
+
+    //! Black-Scholes values on a slice of a binomial tree
+    /*! \c values is resized to the tree.size(i) nodes of the slice,
+        followed by detail::binomialPadding zeros, so that it can be
+        passed to rollbackVanillaFrom_2.
+    */
+    template <class T>
+    void blackScholesSlice_2(const T& tree, Size i,
+                             Time timeToMaturity,
+                             Rate r, Rate q, Volatility v,
+                             const PlainVanillaPayoff& payoff,
+                             bool exercise,
+                             Array& values) {
+        values = Array(tree.size(i) + detail::binomialPadding, 0.0);
+        for (Size j=0; j<tree.size(i); ++j)
+            values[j] = blackScholesNodeValue_2(tree, i, j, timeToMaturity,
+                                                r, q, v, payoff, exercise);
+    }
+
+}
+
+
+#endif
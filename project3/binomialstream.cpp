@@ -0,0 +1,419 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+#include "binomialstream.hpp"
+#include <ql/errors.hpp>
+#include <ql/utilities/null.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace QuantLib {
+
+    namespace {
+
+        template <class T>
+        BinomialOptionResult_2 priceOnTree(const BinomialOptionRow_2& row,
+                                           Array& buffer) {
+            BinomialOptionInputs_2 inputs = {
+                row.spot, row.strike, row.riskFreeRate, row.dividendYield,
+                row.volatility, row.maturity, Option::Type(row.type),
+                Exercise::Type(row.exercise), Size(row.steps)
+            };
+            Size size = binomialWorkspaceSize_2(inputs.steps);
+            if (buffer.size() < size)
+                buffer = Array(size);
+            return binomialPrice_2<T>(inputs, buffer.begin());
+        }
+
+        bool isValid(const BinomialOptionRow_2& row) {
+            return row.spot > 0.0 && row.strike > 0.0 &&
+                row.volatility > 0.0 && row.maturity > 0.0 &&
+                std::isfinite(row.spot) && std::isfinite(row.strike) &&
+                std::isfinite(row.volatility) &&
+                std::isfinite(row.maturity) &&
+                std::isfinite(row.riskFreeRate) &&
+                std::isfinite(row.dividendYield) &&
+                (row.type == Option::Call || row.type == Option::Put) &&
+                (row.exercise == Exercise::American ||
+                 row.exercise == Exercise::European) &&
+                row.tree >= BinomialTreeType_2::CoxRossRubinstein &&
+                row.tree <= BinomialTreeType_2::Joshi4 &&
+                row.steps >= 2;
+        }
+
+    }
+
+    BinomialOptionResult_2 priceBinomialOption_2(
+                                         const BinomialOptionRow_2& row,
+                                         Array& buffer) {
+        BinomialOptionResult_2 none = {
+            Null<Real>(), Null<Real>(), Null<Real>(), Null<Real>()
+        };
+        if (!isValid(row))
+            return none;
+        try {
+            switch (row.tree) {
+              case BinomialTreeType_2::CoxRossRubinstein:
+                return priceOnTree<CoxRossRubinstein_2>(row, buffer);
+              case BinomialTreeType_2::JarrowRudd:
+                return priceOnTree<JarrowRudd_2>(row, buffer);
+              case BinomialTreeType_2::AdditiveEQP:
+                return priceOnTree<AdditiveEQPBinomialTree_2>(row, buffer);
+              case BinomialTreeType_2::Trigeorgis:
+                return priceOnTree<Trigeorgis_2>(row, buffer);
+              case BinomialTreeType_2::Tian:
+                return priceOnTree<Tian_2>(row, buffer);
+              case BinomialTreeType_2::LeisenReimer:
+                return priceOnTree<LeisenReimer_2>(row, buffer);
+              case BinomialTreeType_2::StrikeAligned:
+                return priceOnTree<StrikeAligned_2>(row, buffer);
+              case BinomialTreeType_2::Joshi4:
+                return priceOnTree<Joshi4_2>(row, buffer);
+              default:
+                return none;
+            }
+        } catch (std::exception&) {
+            // e.g., parameters the tree cannot be built on
+            return none;
+        }
+    }
+
+
+    namespace {
+
+        bool isBlank(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        // the end of the line starting at p, i.e., its '\n' or end
+        const char* lineEnd(const char* p, const char* end) {
+            const char* e =
+                static_cast<const char*>(std::memchr(p, '\n', end-p));
+            return e ? e : end;
+        }
+
+        // whether the line [p, e) holds a row
+        bool isRow(const char* p, const char* e) {
+            while (p < e && isBlank(*p))
+                ++p;
+            return p < e && *p != '#';
+        }
+
+        // case-insensitive comparison of [b, e) with a lowercase word
+        bool matches(const char* b, const char* e, const char* word) {
+            for (; b < e && *word; ++b, ++word) {
+                if (std::tolower((unsigned char)*b) != *word)
+                    return false;
+            }
+            return b == e && *word == 0;
+        }
+
+        /* Decimal number in [b, e).  Up to 15 significant digits and
+           powers of ten up to 1e22 are exact in double precision, so
+           that their product or quotient is correctly rounded; other
+           numbers go through strtod. */
+        Real parseReal(const char* b, const char* e, Size row) {
+            static const Real powers[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                1e20, 1e21, 1e22
+            };
+            const char* p = b;
+            bool negative = false;
+            if (p < e && (*p == '-' || *p == '+'))
+                negative = (*p++ == '-');
+            std::uint64_t mantissa = 0;
+            int digits = 0, exponent = 0;
+            bool any = false;
+            for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+                any = true;
+                if (digits < 19) {
+                    mantissa = mantissa*10 + (*p-'0');
+                    if (mantissa != 0)
+                        ++digits;
+                } else {
+                    ++exponent;
+                }
+            }
+            if (p < e && *p == '.') {
+                for (++p; p < e && *p >= '0' && *p <= '9'; ++p) {
+                    any = true;
+                    if (digits < 19) {
+                        mantissa = mantissa*10 + (*p-'0');
+                        if (mantissa != 0)
+                            ++digits;
+                        --exponent;
+                    }
+                }
+            }
+            if (any && p < e && (*p == 'e' || *p == 'E')) {
+                ++p;
+                bool negativeExponent = false;
+                if (p < e && (*p == '-' || *p == '+'))
+                    negativeExponent = (*p++ == '-');
+                int e10 = 0;
+                bool anyExponent = false;
+                for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+                    anyExponent = true;
+                    if (e10 < 10000)
+                        e10 = e10*10 + (*p-'0');
+                }
+                any = anyExponent;
+                exponent += negativeExponent ? -e10 : e10;
+            }
+            QL_REQUIRE(any && p == e,
+                       "invalid number '" << std::string(b, e)
+                       << "' in row " << row);
+
+            Real value;
+            if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+                value = exponent < 0 ? mantissa/powers[-exponent]
+                                     : mantissa*powers[exponent];
+            } else {
+                char buffer[64];
+                QL_REQUIRE(e-b < 64, "number too long in row " << row);
+                std::copy(b, e, buffer);
+                buffer[e-b] = 0;
+                return std::strtod(buffer, 0);
+            }
+            return negative ? -value : value;
+        }
+
+        std::int32_t parseInteger(const char* b, const char* e, Size row) {
+            QL_REQUIRE(b < e && e-b < 10,
+                       "invalid integer '" << std::string(b, e)
+                       << "' in row " << row);
+            std::int32_t n = 0;
+            for (const char* p=b; p<e; ++p) {
+                QL_REQUIRE(*p >= '0' && *p <= '9',
+                           "invalid integer '" << std::string(b, e)
+                           << "' in row " << row);
+                n = n*10 + (*p-'0');
+            }
+            return n;
+        }
+
+        // the fields of a CSV line, in order
+        class CsvFields {
+          public:
+            CsvFields(const char* begin, const char* end, Size row)
+            : p_(begin), end_(end), row_(row), done_(false) {}
+            // the next field, without surrounding blanks
+            void next(const char*& b, const char*& e) {
+                QL_REQUIRE(!done_, "too few fields in row " << row_);
+                const char* comma = static_cast<const char*>(
+                                        std::memchr(p_, ',', end_-p_));
+                b = p_;
+                e = comma ? comma : end_;
+                if (comma)
+                    p_ = comma+1;
+                else
+                    done_ = true;
+                while (b < e && isBlank(*b))
+                    ++b;
+                while (e > b && isBlank(e[-1]))
+                    --e;
+            }
+            Real real() {
+                const char *b, *e;
+                next(b, e);
+                return parseReal(b, e, row_);
+            }
+            bool finished() const { return done_; }
+          private:
+            const char* p_;
+            const char* end_;
+            Size row_;
+            bool done_;
+        };
+
+        BinomialOptionRow_2 parseRow(const char* begin, const char* end,
+                                     Size row) {
+            static const char* trees[] = {
+                "crr", "jr", "eqp", "trigeorgis", "tian", "lr",
+                "strikealigned", "joshi4"
+            };
+            CsvFields fields(begin, end, row);
+            BinomialOptionRow_2 result;
+            const char *b, *e;
+
+            fields.next(b, e);
+            if (matches(b, e, "c") || matches(b, e, "call"))
+                result.type = Option::Call;
+            else if (matches(b, e, "p") || matches(b, e, "put"))
+                result.type = Option::Put;
+            else
+                QL_FAIL("unknown option type '" << std::string(b, e)
+                        << "' in row " << row);
+
+            result.spot = fields.real();
+            result.strike = fields.real();
+            result.riskFreeRate = fields.real();
+            result.dividendYield = fields.real();
+            result.volatility = fields.real();
+            result.maturity = fields.real();
+
+            fields.next(b, e);
+            if (matches(b, e, "e") || matches(b, e, "european"))
+                result.exercise = Exercise::European;
+            else if (matches(b, e, "a") || matches(b, e, "american"))
+                result.exercise = Exercise::American;
+            else
+                QL_FAIL("unknown exercise '" << std::string(b, e)
+                        << "' in row " << row);
+
+            fields.next(b, e);
+            result.tree = -1;
+            for (std::int32_t k=0; k<=BinomialTreeType_2::Joshi4; ++k) {
+                if (matches(b, e, trees[k]))
+                    result.tree = k;
+            }
+            QL_REQUIRE(result.tree >= 0,
+                       "unknown tree '" << std::string(b, e)
+                       << "' in row " << row);
+
+            fields.next(b, e);
+            result.steps = parseInteger(b, e, row);
+            QL_REQUIRE(fields.finished(), "too many fields in row " << row);
+            return result;
+        }
+
+        // chunk of a CSV file, ending where the next one starts
+        struct CsvChunk {
+            const char* begin;
+            Size firstRow;
+        };
+
+        // per-thread state
+        struct Context {
+            Array values;
+        };
+
+    }
+
+
+    BinomialChainPricer_2::BinomialChainPricer_2(
+                                 const boost::shared_ptr<ThreadPool_2>& pool,
+                                 Size chunkRows)
+    : pool_(pool), chunkRows_(chunkRows) {
+        QL_REQUIRE(chunkRows > 0, "at least one row per chunk required");
+    }
+
+    Size BinomialChainPricer_2::price(const std::string& input,
+                                      const std::string& output) const {
+        MappedFile_2 in(input);
+        const char* data = in.data();
+        const char* end = data + in.size();
+        const Size headerSize = sizeof(BinomialChainHeader_2);
+
+        // rows, and how they are split
+        bool binary = in.size() >= headerSize &&
+            std::memcmp(data, BinomialChainHeader_2::rowsMagic(), 8) == 0;
+        const BinomialOptionRow_2* binaryRows = 0;
+        std::vector<CsvChunk> chunks;
+        Size rows = 0, chunkCount;
+        if (binary) {
+            const BinomialChainHeader_2* header =
+                reinterpret_cast<const BinomialChainHeader_2*>(data);
+            rows = header->rows;
+            QL_REQUIRE(in.size() ==
+                       headerSize + rows*sizeof(BinomialOptionRow_2),
+                       input << " should hold " << rows << " rows in "
+                       << headerSize + rows*sizeof(BinomialOptionRow_2)
+                       << " bytes, not " << in.size());
+            binaryRows = reinterpret_cast<const BinomialOptionRow_2*>(
+                                                          data + headerSize);
+            chunkCount = (rows + chunkRows_ - 1)/chunkRows_;
+        } else {
+            // skip the header line, then find where chunks start
+            const char* p = data ? lineEnd(data, end) : end;
+            if (p < end)
+                ++p;
+            CsvChunk first = { p, 0 };
+            chunks.push_back(first);
+            Size inChunk = 0;
+            while (p < end) {
+                const char* e = lineEnd(p, end);
+                if (isRow(p, e)) {
+                    if (inChunk == chunkRows_) {
+                        CsvChunk chunk = { p, rows };
+                        chunks.push_back(chunk);
+                        inChunk = 0;
+                    }
+                    ++rows;
+                    ++inChunk;
+                }
+                p = (e < end ? e+1 : end);
+            }
+            chunkCount = chunks.size();
+        }
+
+        // columnar output, written in place
+        MappedFile_2 out(output, headerSize + 4*rows*sizeof(double));
+        BinomialChainHeader_2* header =
+            reinterpret_cast<BinomialChainHeader_2*>(out.data());
+        std::memcpy(header->magic, BinomialChainHeader_2::resultsMagic(), 8);
+        header->rows = rows;
+        double* values = reinterpret_cast<double*>(out.data() + headerSize);
+        double* deltas = values + rows;
+        double* gammas = deltas + rows;
+        double* thetas = gammas + rows;
+
+        Size threads = (pool_ && pool_->size() > 1) ? pool_->size() : 1;
+        std::vector<Context> contexts(threads);
+        auto priceChunk = [&](Size p, Size c) {
+            Array& buffer = contexts[p].values;
+            auto store = [&](Size k, const BinomialOptionRow_2& row) {
+                BinomialOptionResult_2 result =
+                    priceBinomialOption_2(row, buffer);
+                values[k] = result.value;
+                deltas[k] = result.delta;
+                gammas[k] = result.gamma;
+                thetas[k] = result.theta;
+            };
+            if (binary) {
+                Size last = std::min(rows, (c+1)*chunkRows_);
+                for (Size k=c*chunkRows_; k<last; ++k)
+                    store(k, binaryRows[k]);
+            } else {
+                const char* line = chunks[c].begin;
+                const char* stop =
+                    c+1 < chunks.size() ? chunks[c+1].begin : end;
+                Size k = chunks[c].firstRow;
+                while (line < stop) {
+                    const char* e = lineEnd(line, stop);
+                    if (isRow(line, e)) {
+                        store(k, parseRow(line, e, k));
+                        ++k;
+                    }
+                    line = (e < stop ? e+1 : stop);
+                }
+            }
+        };
+        if (threads > 1) {
+            pool_->forEach(chunkCount, priceChunk);
+        } else {
+            for (Size c=0; c<chunkCount; ++c)
+                priceChunk(0, c);
+        }
+        return rows;
+    }
+
+}
@@ -0,0 +1,121 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialstream.hpp
+    \brief Streaming pricer of option chains stored in files
+*/
+
+#ifndef binomial_stream_hpp
+#define binomial_stream_hpp
+
+#include "binomialdirect.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+#include <ql/math/array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstdint>
+#include <string>
+
+namespace QuantLib {
+
+    //! One option of a chain, as stored in binary files
+    /*! The integer fields hold the values of the QuantLib enums,
+        i.e., Option::Type (1 for calls, -1 for puts),
+        Exercise::Type (only American and European are supported)
+        and BinomialTreeType_2::Type.  The maturity is a time in
+        years.
+    */
+    struct BinomialOptionRow_2 {
+        double spot, strike, riskFreeRate, dividendYield, volatility,
+               maturity;
+        std::int32_t type, exercise, tree, steps;
+    };
+
+    //! Header of binary chain files, followed by the rows
+    struct BinomialChainHeader_2 {
+        char magic[8];
+        std::uint64_t rows;
+        //! the magic string of row files
+        static const char* rowsMagic() { return "QLCHAIN1"; }
+        //! the magic string of result files
+        static const char* resultsMagic() { return "QLGREEK1"; }
+    };
+
+
+    //! prices a row on its tree, using the given buffer as workspace
+    /*! The row is priced with binomialPrice_2, without going through
+        a process or any other QuantLib object, so that rows can be
+        priced concurrently.  Rows with invalid values get null
+        results.
+    */
+    BinomialOptionResult_2 priceBinomialOption_2(
+                                         const BinomialOptionRow_2& row,
+                                         Array& buffer);
+
+
+    //! Streaming pricer of option chains
+    /*! price() reads a chain of options from a file and writes their
+        value, delta, gamma and theta to another.  Both files are
+        memory-mapped; the input can be
+
+        - a binary file made of a BinomialChainHeader_2 with the
+          rowsMagic() string and the number of rows, followed by as
+          many BinomialOptionRow_2 in the native byte order; the rows
+          are priced in place, without copies;
+        - a CSV file with a header line, then one row per line with
+          the fields
+          \code
+          type,spot,strike,r,q,vol,expiry,exercise,tree,steps
+          \endcode
+          where \c type is C or P (or Call or Put), \c expiry a time
+          in years, \c exercise E or A (or European or American) and
+          \c tree one of crr, jr, eqp, trigeorgis, tian, lr,
+          strikealigned and joshi4.  Blank lines and lines starting
+          with # are skipped.  Fields are parsed directly from the
+          mapping.
+
+        The input is split in chunks of \c chunkRows rows (for CSV
+        files, by a single scan for line ends) which are parsed and
+        priced on the threads of the pool with
+        ThreadPool_2::forEach; each thread has its own parsing and
+        rollback buffers, and writes its results in place in the
+        output mapping.
+
+        The output is columnar: a BinomialChainHeader_2 with the
+        resultsMagic() string and the number of rows, followed by
+        the values, deltas, gammas and thetas of all rows, in this
+        order, each as a contiguous array of doubles in the order
+        of the input rows.  Rows that cannot be priced get null
+        results; malformed CSV lines raise an exception.
+    */
+    class BinomialChainPricer_2 {
+      public:
+        BinomialChainPricer_2(const boost::shared_ptr<ThreadPool_2>& pool =
+                                          boost::shared_ptr<ThreadPool_2>(),
+                              Size chunkRows = 4096);
+        //! prices the chain in \c input and returns the number of rows
+        Size price(const std::string& input,
+                   const std::string& output) const;
+      private:
+        boost::shared_ptr<ThreadPool_2> pool_;
+        Size chunkRows_;
+    };
+
+}
+
+
+#endif
@@ -0,0 +1,424 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialsurface.hpp
+    \brief Option values on the early slices of a binomial tree
+*/
+
+#ifndef binomial_surface_hpp
+#define binomial_surface_hpp
+
+#include "binomialrollback.hpp"
+#include "mappedfile.hpp"
+#include <ql/exercise.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Contract, flat market and tree a value surface is recorded for
+    /*! As in BinomialOptionRow_2, the integer fields hold the values
+        of Option::Type, Exercise::Type, BinomialTreeType_2::Type and
+        BinomialSmoothing_2::Type, and the maturity is a time in
+        years.  The refined steps and refinement factor are the ones
+        of the adaptive mesh, both null without it.
+    */
+    struct BinomialSurfaceKey_2 {
+        double strike, riskFreeRate, dividendYield, volatility, maturity;
+        std::int32_t type, exercise, tree, smoothing;
+        std::uint64_t steps, refinedSteps, refinementFactor;
+    };
+
+    //! Header of value-surface files
+    /*! It is followed by the stored slices, as an array of
+        BinomialSurfaceSlice_2, and by their node values as an array
+        of doubles, all in the native byte order.
+    */
+    struct BinomialSurfaceHeader_2 {
+        char magic[8];
+        BinomialSurfaceKey_2 key;
+        //! spot at the middle node of the initial slice
+        double spot;
+        //! time step and logarithm of the ratio q of the node prices
+        double dt, logGrowth;
+        //! tolerance region
+        double maxElapsed, spotRange;
+        std::uint64_t timeStride, slices, nodes;
+        static const char* magicString() { return "QLSURF02"; }
+    };
+
+    //! Node values stored for a slice of the tree
+    /*! The values on the nodes first to first+size-1 of the slice
+        are stored from the given offset in the values array; the
+        node prices are base*q^k for k=0,...,size-1.
+    */
+    struct BinomialSurfaceSlice_2 {
+        double base;
+        std::uint64_t step, first, size, offset;
+    };
+
+
+    //! Option values around the spot on the early slices of a tree
+    /*! A rollback on a tree with constant parameters computes the
+        option value on every (time, spot) node and only returns the
+        ones at t=0.  The surface keeps a subsample of them: the
+        values on every \c timeStride-th slice up to \c maxElapsed
+        years after the start of the tree (plus the slice after, so
+        that the last one brackets it), restricted to the nodes
+        within \c spotRange in log-spot of the initial spot and a
+        couple more on each side.  It is thus a few kilobytes even
+        for large trees, and is recorded while rolling back (see
+        rollbackVanillaSurface_2) at the cost of a few copies.
+
+        On a flat market without dividends, the value of the option
+        at time t and spot S equals the value of the same option
+        with a maturity shorter by t at the same spot.  Requests for
+        the same contract and market, priced on the same tree, a
+        little later and at a nearby spot can therefore be served
+        from the surface: interpolate() finds the node nearest to
+        the spot on the two stored slices bracketing the elapsed
+        time, fits a quadratic in the spot through it and its two
+        neighbours, which gives value, delta and gamma, and
+        interpolates linearly in time.  This takes a few logarithms
+        and exponentials.  Requests outside the tolerance region,
+        i.e., more than \c maxElapsed later, further than
+        \c spotRange from the initial spot or with a different
+        contract, market or tree (including its smoothing and
+        adaptive mesh), are rejected so that the caller can
+        reprice.  The first slices of a tree only
+        have a few nodes, so that requests very soon after the
+        rollback are only served close to the spot unless the tree
+        has a wider initial slice (see
+        BinomialTree_2::setInitialWidth) covering the spot range.
+
+        The surface can be saved to a file and mapped back in
+        memory, without copies, from another process.  Surfaces
+        loaded from a file keep the tolerance region they were
+        recorded with.
+
+        \ingroup lattices
+    */
+    class BinomialValueSurface_2 {
+      public:
+        //! empty surface, to be recorded by a rollback
+        BinomialValueSurface_2(Time maxElapsed, Real spotRange,
+                               Size timeStride = 1);
+        //! surface saved to the given file, mapped in memory
+        explicit BinomialValueSurface_2(const std::string& path);
+        //! \name Inspectors
+        //@{
+        bool empty() const { return header_.slices == 0; }
+        const BinomialSurfaceHeader_2& header() const { return header_; }
+        Time maxElapsed() const { return header_.maxElapsed; }
+        Real spotRange() const { return header_.spotRange; }
+        Size timeStride() const { return header_.timeStride; }
+        //! stored slices
+        Size slices() const { return header_.slices; }
+        //! stored node values
+        Size nodes() const { return header_.nodes; }
+        //@}
+        //! value, delta and gamma at the given spot for the given key
+        /*! The elapsed time is the difference between the maturity
+            the surface was recorded for and the one in the key.
+            Returns false, and leaves the results untouched, if the
+            request is outside the tolerance region.
+        */
+        bool interpolate(const BinomialSurfaceKey_2& key, Real spot,
+                         Real& value, Real& delta, Real& gamma) const;
+        //! writes the surface to the given file
+        void save(const std::string& path) const;
+        //! \name Recording
+        //@{
+        //! discards the stored values and starts a new surface
+        void reset(const BinomialSurfaceKey_2& key, Real spot,
+                   Real logGrowth);
+        //! stores the values on the nodes first to first+size-1 of
+        //! the given slice, whose node prices are base*q^(j-first)
+        void add(Size step, Real base, Size first, const Real* values,
+                 Size size);
+        //@}
+      private:
+        BinomialValueSurface_2(const BinomialValueSurface_2&);
+        BinomialValueSurface_2& operator=(const BinomialValueSurface_2&);
+        BinomialSurfaceHeader_2 header_;
+        // either owned or pointing into the mapped file
+        const BinomialSurfaceSlice_2* slices_;
+        const Real* values_;
+        std::vector<BinomialSurfaceSlice_2> ownedSlices_;
+        std::vector<Real> ownedValues_;
+        boost::shared_ptr<MappedFile_2> file_;
+    };
+
+
+    namespace detail {
+
+        // last slice kept by the surface: the first multiple of the
+        // stride at or past the maximum elapsed time, and no further
+        // than the given one; the others are the multiples below
+        inline Size binomialSurfaceTop(const BinomialValueSurface_2& surface,
+                                       Time dt, Size from) {
+            Size stride = surface.timeStride();
+            Real blocks = std::ceil(surface.maxElapsed()/(stride*dt));
+            if (blocks*stride >= Real(from))
+                return from;
+            return std::max(Size(blocks), Size(1))*stride;
+        }
+
+        // stores the nodes of slice i within the spot range, plus two
+        // on each side
+        inline void binomialSurfaceAdd(BinomialValueSurface_2& surface,
+                                       const BinomialSlices_2& slices,
+                                       Size i, const Real* values) {
+            const BinomialSurfaceHeader_2& header = surface.header();
+            Real c = header.logGrowth;
+            Real x = std::log(header.spot/slices.base(i))/c
+                   + Real(slices.anchor());
+            Real width = surface.spotRange()/c;
+            Real low = std::max(std::ceil(x - width) - 2.0, 0.0);
+            Real high = std::min(std::floor(x + width) + 2.0,
+                                 Real(slices.size(i)-1));
+            if (high < low)
+                return;
+            Size first = Size(low);
+            surface.add(i, slices.underlying(i, first), first,
+                        values + first, Size(high) - first + 1);
+        }
+
+    }
+
+
+    //! In-place backward induction recording a value surface
+    /*! Same as rollbackVanillaFrom_2, but the rollback stops on the
+        slices kept by the surface (see BinomialValueSurface_2) and
+        stores their values around the spot; the rollback is tiled
+        down to the first of them.  The surface is reset first, with
+        the given key and the middle node of the initial slice as
+        spot, and is left empty on trees with dividends.
+
+        \ingroup lattices
+    */
+    inline void rollbackVanillaSurface_2(const BinomialSlices_2& slices,
+                                         Size from,
+                                         DiscountFactor discount,
+                                         const PlainVanillaPayoff& payoff,
+                                         Size firstExerciseStep,
+                                         Array& values,
+                                         const BinomialSurfaceKey_2& key,
+                                         BinomialValueSurface_2& surface,
+                                         Size blockSteps = 128,
+                                         Size tileWidth = 4096) {
+        QL_REQUIRE(blockSteps > 0, "null block size");
+        QL_REQUIRE(from <= slices.steps(),
+                   "slice " << from << " past the last one ("
+                   << slices.steps() << ")");
+        QL_REQUIRE(values.size() >= slices.size(from)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(from)+detail::binomialPadding
+                   << " elements required");
+        Real strike = payoff.strike();
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+
+        Size middle = (slices.size(0)-1)/2;
+        surface.reset(key, slices.underlying(0, middle),
+                      std::log(slices.ratio()));
+        if (slices.shift(0) != 0.0) {
+            // the node prices are shifted by the dividends
+            detail::binomialRollback(values.begin(), from, slices,
+                                     discount, omega, strike,
+                                     firstExerciseStep,
+                                     blockSteps, tileWidth);
+            return;
+        }
+
+        Size stride = surface.timeStride();
+        Size i = detail::binomialSurfaceTop(surface,
+                                            key.maturity/key.steps, from);
+        detail::binomialRollback(values.begin(), from, slices, discount,
+                                 omega, strike, firstExerciseStep,
+                                 blockSteps, tileWidth, i);
+        detail::binomialSurfaceAdd(surface, slices, i, values.begin());
+        while (i > 0) {
+            Size next = i - (i % stride == 0 ? stride : i % stride);
+            detail::binomialRollback(values.begin(), i, slices, discount,
+                                     omega, strike, firstExerciseStep,
+                                     blockSteps, tileWidth, next);
+            i = next;
+            detail::binomialSurfaceAdd(surface, slices, i, values.begin());
+        }
+    }
+
+
+    // inline definitions
+
+    inline BinomialValueSurface_2::BinomialValueSurface_2(Time maxElapsed,
+                                                          Real spotRange,
+                                                          Size timeStride)
+    : slices_(0), values_(0) {
+        QL_REQUIRE(maxElapsed > 0.0,
+                   "positive maximum elapsed time required, "
+                   << maxElapsed << " provided");
+        QL_REQUIRE(spotRange > 0.0,
+                   "positive spot range required, "
+                   << spotRange << " provided");
+        QL_REQUIRE(timeStride > 0, "null time stride given");
+        std::memset(&header_, 0, sizeof(header_));
+        std::memcpy(header_.magic, BinomialSurfaceHeader_2::magicString(),
+                    sizeof(header_.magic));
+        header_.maxElapsed = maxElapsed;
+        header_.spotRange = spotRange;
+        header_.timeStride = timeStride;
+    }
+
+    inline BinomialValueSurface_2::BinomialValueSurface_2(
+                                                  const std::string& path)
+    : slices_(0), values_(0), file_(new MappedFile_2(path)) {
+        const char* data = file_->data();
+        QL_REQUIRE(file_->size() >= sizeof(header_) &&
+                   std::memcmp(data, BinomialSurfaceHeader_2::magicString(),
+                               sizeof(header_.magic)) == 0,
+                   path << " is not a value-surface file");
+        std::memcpy(&header_, data, sizeof(header_));
+        QL_REQUIRE(file_->size() ==
+                   sizeof(header_) +
+                   header_.slices*sizeof(BinomialSurfaceSlice_2) +
+                   header_.nodes*sizeof(Real),
+                   path << " has " << file_->size() << " bytes, "
+                   << header_.slices << " slices and " << header_.nodes
+                   << " nodes expected");
+        slices_ = reinterpret_cast<const BinomialSurfaceSlice_2*>(
+                                                     data + sizeof(header_));
+        values_ = reinterpret_cast<const Real*>(slices_ + header_.slices);
+    }
+
+    inline bool BinomialValueSurface_2::interpolate(
+                                           const BinomialSurfaceKey_2& key,
+                                           Real spot,
+                                           Real& value, Real& delta,
+                                           Real& gamma) const {
+        const BinomialSurfaceKey_2& recorded = header_.key;
+        if (empty() ||
+            key.strike != recorded.strike ||
+            key.riskFreeRate != recorded.riskFreeRate ||
+            key.dividendYield != recorded.dividendYield ||
+            key.volatility != recorded.volatility ||
+            key.type != recorded.type || key.exercise != recorded.exercise ||
+            key.tree != recorded.tree ||
+            key.smoothing != recorded.smoothing ||
+            key.steps != recorded.steps ||
+            key.refinedSteps != recorded.refinedSteps ||
+            key.refinementFactor != recorded.refinementFactor)
+            return false;
+        Time elapsed = recorded.maturity - key.maturity;
+        if (elapsed < 0.0 || elapsed > header_.maxElapsed ||
+            std::fabs(std::log(spot/header_.spot)) > header_.spotRange)
+            return false;
+
+        // stored slices bracketing the elapsed time; they are sorted
+        // by decreasing step
+        Real u = elapsed/header_.dt;
+        Size k = header_.slices-1;
+        while (k > 0 && slices_[k-1].step <= u)
+            --k;
+        Size l = (k > 0 ? k-1 : k);
+        if (slices_[l].step < u)
+            return false;
+
+        Real f[2], d[2], g[2];
+        Size pair[2] = { k, l };
+        Real c = header_.logGrowth, growth = std::exp(c);
+        for (Size p=0; p<2; ++p) {
+            const BinomialSurfaceSlice_2& slice = slices_[pair[p]];
+            // quadratic through the nearest node and its neighbours
+            Real x = std::log(spot/slice.base)/c;
+            Real j = std::floor(x + 0.5);
+            if (j < 1.0 || j+2.0 > Real(slice.size))
+                return false;
+            const Real* v = values_ + slice.offset + Size(j);
+            Real s1 = slice.base*std::exp(c*j);
+            Real s0 = s1/growth, s2 = s1*growth;
+            Real d0 = (s0-s1)*(s0-s2), d1 = (s1-s0)*(s1-s2),
+                 d2 = (s2-s0)*(s2-s1);
+            f[p] = v[-1]*(spot-s1)*(spot-s2)/d0
+                 + v[0]*(spot-s0)*(spot-s2)/d1
+                 + v[1]*(spot-s0)*(spot-s1)/d2;
+            d[p] = v[-1]*((spot-s1)+(spot-s2))/d0
+                 + v[0]*((spot-s0)+(spot-s2))/d1
+                 + v[1]*((spot-s0)+(spot-s1))/d2;
+            g[p] = 2.0*(v[-1]/d0 + v[0]/d1 + v[1]/d2);
+        }
+
+        Real span = Real(slices_[l].step) - Real(slices_[k].step);
+        Real w = (span > 0.0 ? (u - slices_[k].step)/span : 0.0);
+        value = (1.0-w)*f[0] + w*f[1];
+        delta = (1.0-w)*d[0] + w*d[1];
+        gamma = (1.0-w)*g[0] + w*g[1];
+        return true;
+    }
+
+    inline void BinomialValueSurface_2::save(const std::string& path) const {
+        Size slicesSize = header_.slices*sizeof(BinomialSurfaceSlice_2);
+        Size valuesSize = header_.nodes*sizeof(Real);
+        MappedFile_2 file(path, sizeof(header_) + slicesSize + valuesSize);
+        char* data = file.data();
+        std::memcpy(data, &header_, sizeof(header_));
+        if (slicesSize > 0)
+            std::memcpy(data + sizeof(header_), slices_, slicesSize);
+        if (valuesSize > 0)
+            std::memcpy(data + sizeof(header_) + slicesSize, values_,
+                        valuesSize);
+    }
+
+    inline void BinomialValueSurface_2::reset(
+                                         const BinomialSurfaceKey_2& key,
+                                         Real spot, Real logGrowth) {
+        file_.reset();
+        ownedSlices_.clear();
+        ownedValues_.clear();
+        slices_ = 0;
+        values_ = 0;
+        header_.key = key;
+        header_.spot = spot;
+        header_.dt = key.maturity/key.steps;
+        header_.logGrowth = logGrowth;
+        header_.slices = 0;
+        header_.nodes = 0;
+    }
+
+    inline void BinomialValueSurface_2::add(Size step, Real base, Size first,
+                                            const Real* values, Size size) {
+        QL_REQUIRE(!file_, "cannot add slices to a mapped surface");
+        QL_REQUIRE(ownedSlices_.empty() || step < ownedSlices_.back().step,
+                   "slices must be added by decreasing step");
+        BinomialSurfaceSlice_2 slice = {
+            base, step, first, size, ownedValues_.size()
+        };
+        ownedSlices_.push_back(slice);
+        ownedValues_.insert(ownedValues_.end(), values, values+size);
+        slices_ = &ownedSlices_[0];
+        values_ = &ownedValues_[0];
+        header_.slices = ownedSlices_.size();
+        header_.nodes = ownedValues_.size();
+    }
+
+}
+
+
+#endif
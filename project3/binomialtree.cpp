@@ -117,6 +117,39 @@ namespace QuantLib {
 
     }
 
+    StrikeAligned_2::StrikeAligned_2(
+                        const boost::shared_ptr<StochasticProcess1D>& process,
+                        Time end, Size steps, Real strike)
+    : BinomialTree_2<StrikeAligned_2>(process, end, steps) {
+
+        QL_REQUIRE(strike>0.0, "strike must be positive");
+        Real variance = process->variance(0.0, x0_, dt_);
+        Real growth = std::exp(driftPerStep_ + 0.5*variance);
+        Real logStrike = std::log(strike/x0_);
+
+        // terminal node closest to the strike on the CRR tree,
+        // counted in up moves
+        Real dx = std::sqrt(variance);
+        Real upMoves = std::floor((logStrike + steps*dx)/(2.0*dx) + 0.5);
+        bool aligned = (upMoves >= 0.0 && upMoves <= Real(steps));
+
+        // the tilt reduces the variance of the jumps slightly; a few
+        // rescalings of the jump size restore it
+        for (Size k=0; k<3; ++k) {
+            Real tilt = aligned ?
+                (logStrike - (2.0*upMoves - steps)*dx)/steps : 0.0;
+            up_ = std::exp(dx + tilt);
+            down_ = std::exp(-dx + tilt);
+            pu_ = (growth - down_) / (up_ - down_);
+            pd_ = 1.0 - pu_;
+            dx *= std::sqrt(variance/(4.0*dx*dx*pu_*pd_));
+        }
+
+        QL_REQUIRE(pu_<=1.0, "negative probability");
+        QL_REQUIRE(pu_>=0.0, "negative probability");
+    }
+
+
     Real Joshi4_2::computeUpProb(Real k, Real dj) const {
         Real alpha = dj/(std::sqrt(8.0));
         Real alpha2 = alpha*alpha;
@@ -32,29 +32,97 @@
 
 namespace QuantLib {
 
+    //! Identifiers of the trees below
+    /*! Each tree gives its own as \c treeType; they identify it in
+        option-chain files and value surfaces.
+    */
+    struct BinomialTreeType_2 {
+        enum Type {
+            CoxRossRubinstein,  //!< CoxRossRubinstein_2
+            JarrowRudd,         //!< JarrowRudd_2
+            AdditiveEQP,        //!< AdditiveEQPBinomialTree_2
+            Trigeorgis,         //!< Trigeorgis_2
+            Tian,               //!< Tian_2
+            LeisenReimer,       //!< LeisenReimer_2
+            StrikeAligned,      //!< StrikeAligned_2
+            Joshi4              //!< Joshi4_2
+        };
+    };
+
+
     //! Binomial tree base class
     /*! \ingroup lattices */
     template <class T>
     class BinomialTree_2 : public Tree<T> {
       public:
         enum Branches { branches = 2 };
+        //! node prices on a slice are a geometric progression plus
+        //! a per-slice dividend shift (see setDividends), and branch
+        //! probabilities do not change between slices
+        enum Parameters { constantParameters = 1 };
+        //! the lattice does not depend on the strike given to the
+        //! constructor and can be shared by options on any strike
+        enum Strike { strikeIndependent = 1 };
         BinomialTree_2(const boost::shared_ptr<StochasticProcess1D>& process,
                        Time end,
                        Size steps)
-        : Tree<T>(steps+1) {
+        : Tree<T>(steps+1), width_(1) {
             x0_ = process->x0();
             dt_ = end/steps;
             driftPerStep_ = process->drift(0.0, x0_) * dt_;
         }
         Size size(Size i) const {
-            return i+3;
+            return i+2*width_+1;
         }
         Size descendant(Size, Size index, Size branch) const {
             return index + branch;
         }
+        //! escrowed discrete dividends
+        /*! The tree is assumed to be built on the spot net of the
+            present value of the dividends paid up to its end; the
+            present value of the dividends still to be paid after
+            each slice is precomputed here and added back to the
+            node prices, so that the tree stays recombining.
+        */
+        void setDividends(const std::vector<Time>& dividendTimes,
+                          const std::vector<Real>& dividendAmounts,
+                          Rate riskFreeRate) {
+            QL_REQUIRE(dividendTimes.size() == dividendAmounts.size(),
+                       "size mismatch between dividend times ("
+                       << dividendTimes.size() << ") and amounts ("
+                       << dividendAmounts.size() << ")");
+            dividendAdjustment_ = std::vector<Real>(this->columns(), 0.0);
+            for (Size i=0; i<this->columns(); ++i) {
+                Time t = i*dt_;
+                for (Size k=0; k<dividendTimes.size(); ++k) {
+                    if (dividendTimes[k] > t)
+                        dividendAdjustment_[i] += dividendAmounts[k] *
+                            std::exp(-riskFreeRate*(dividendTimes[k]-t));
+                }
+            }
+        }
+        //! present value at slice i of the dividends paid after it
+        Real dividendAdjustment(Size i) const {
+            return dividendAdjustment_.empty() ? 0.0 : dividendAdjustment_[i];
+        }
+        //! widened initial slice
+        /*! The tree carries 2m+1 nodes at t=0, centered on x0 at
+            node m, instead of the default three; a single rollback
+            then gives the option values on a ladder of spot levels
+            spaced as the nodes of the tree.
+        */
+        void setInitialWidth(Size m) {
+            QL_REQUIRE(m >= 1, "at least one node on each side of the "
+                       "initial one required");
+            width_ = m;
+        }
+        //! nodes on each side of x0 at t=0
+        Size initialWidth() const { return width_; }
       protected:
+        Size width_;
         Real x0_, driftPerStep_;
         Time dt_;
+        std::vector<Real> dividendAdjustment_;
     };
 
 
@@ -69,9 +137,11 @@ namespace QuantLib {
                         Size steps)
         : BinomialTree_2<T>(process, end, steps) {}
         Real underlying(Size i, Size index) const {
-            BigInteger j = 2*BigInteger(index) - BigInteger(i) - BigInteger(2);
+            BigInteger j = 2*BigInteger(index) - BigInteger(i)
+                - 2*BigInteger(this->width_);
             // exploiting the forward value tree centering
-            return this->x0_*std::exp(i*this->driftPerStep_ + j*this->up_);
+            return this->x0_*std::exp(i*this->driftPerStep_ + j*this->up_)
+                + this->dividendAdjustment(i);
         }
         Real probability(Size, Size, Size) const { return 0.5; }
       protected:
@@ -90,9 +160,11 @@ namespace QuantLib {
                         Size steps)
         : BinomialTree_2<T>(process, end, steps) {}
         Real underlying(Size i, Size index) const {
-            BigInteger j = 2*BigInteger(index) - BigInteger(i) - BigInteger(2);
+            BigInteger j = 2*BigInteger(index) - BigInteger(i)
+                - 2*BigInteger(this->width_);
             // exploiting equal jump and the x0_ tree centering
-            return this->x0_*std::exp(j*this->dx_);
+            return this->x0_*std::exp(j*this->dx_)
+                + this->dividendAdjustment(i);
         }
         Real probability(Size, Size, Size branch) const {
             return (branch == 1 ? pu_ : pd_);
@@ -106,6 +178,7 @@ namespace QuantLib {
     /*! \ingroup lattices */
     class JarrowRudd_2 : public EqualProbabilitiesBinomialTree_2<JarrowRudd_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::JarrowRudd };
         JarrowRudd_2(const boost::shared_ptr<StochasticProcess1D>&,
                      Time end,
                      Size steps,
@@ -118,6 +191,7 @@ namespace QuantLib {
     class CoxRossRubinstein_2
         : public EqualJumpsBinomialTree_2<CoxRossRubinstein_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::CoxRossRubinstein };
         CoxRossRubinstein_2(const boost::shared_ptr<StochasticProcess1D>&,
                             Time end,
                             Size steps,
@@ -130,6 +204,7 @@ namespace QuantLib {
     class AdditiveEQPBinomialTree_2
         : public EqualProbabilitiesBinomialTree_2<AdditiveEQPBinomialTree_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::AdditiveEQP };
         AdditiveEQPBinomialTree_2(
                         const boost::shared_ptr<StochasticProcess1D>&,
                         Time end,
@@ -142,6 +217,7 @@ namespace QuantLib {
     /*! \ingroup lattices */
     class Trigeorgis_2 : public EqualJumpsBinomialTree_2<Trigeorgis_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::Trigeorgis };
         Trigeorgis_2(const boost::shared_ptr<StochasticProcess1D>&,
                      Time end,
                      Size steps,
@@ -153,13 +229,16 @@ namespace QuantLib {
     /*! \ingroup lattices */
     class Tian_2 : public BinomialTree_2<Tian_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::Tian };
         Tian_2(const boost::shared_ptr<StochasticProcess1D>&,
                Time end,
                Size steps,
                Real strike);
         Real underlying(Size i, Size index) const {
-            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))+1)
-                       * std::pow(up_, Real(index)-1);
+            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))
+                                         +width_)
+                       * std::pow(up_, Real(index)-width_)
+                + dividendAdjustment(i);
         };
         Real probability(Size, Size, Size branch) const {
             return (branch == 1 ? pu_ : pd_);
@@ -172,13 +251,56 @@ namespace QuantLib {
     /*! \ingroup lattices */
     class LeisenReimer_2 : public BinomialTree_2<LeisenReimer_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::LeisenReimer };
+        enum Strike { strikeIndependent = 0 };
         LeisenReimer_2(const boost::shared_ptr<StochasticProcess1D>&,
                        Time end,
                        Size steps,
                        Real strike);
         Real underlying(Size i, Size index) const {
-            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))+1)
-                       * std::pow(up_, Real(index)-1);
+            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))
+                                         +width_)
+                       * std::pow(up_, Real(index)-width_)
+                + dividendAdjustment(i);
+        }
+        Real probability(Size, Size, Size branch) const {
+            return (branch == 1 ? pu_ : pd_);
+        }
+      protected:
+        Real up_, down_, pu_, pd_;
+    };
+
+
+    //! Strike-aligned tree: tilted Cox-Ross-Rubinstein
+    /*! The log-price jumps of the CRR tree are shifted by a small
+        tilt, the same for up and down moves, chosen so that the
+        terminal node closest to the strike falls exactly on it (see
+        Tian, "A flexible binomial option pricing model", 1999.)
+        The branch probabilities match the expected growth of the
+        underlying, and the jump size is rescaled so that the
+        variance of the log-price over a step is the one of the
+        process.
+
+        Since the kink of the payoff is always on a node, the error
+        on vanilla options decreases smoothly, as 1/N, instead of
+        oscillating with the position of the strike; this makes the
+        tree well suited to Richardson extrapolation.
+
+        \ingroup lattices
+    */
+    class StrikeAligned_2 : public BinomialTree_2<StrikeAligned_2> {
+      public:
+        enum TreeType { treeType = BinomialTreeType_2::StrikeAligned };
+        enum Strike { strikeIndependent = 0 };
+        StrikeAligned_2(const boost::shared_ptr<StochasticProcess1D>&,
+                        Time end,
+                        Size steps,
+                        Real strike);
+        Real underlying(Size i, Size index) const {
+            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))
+                                         +width_)
+                       * std::pow(up_, Real(index)-width_)
+                + dividendAdjustment(i);
         }
         Real probability(Size, Size, Size branch) const {
             return (branch == 1 ? pu_ : pd_);
@@ -190,13 +312,17 @@ namespace QuantLib {
 
      class Joshi4_2 : public BinomialTree_2<Joshi4_2> {
       public:
+        enum TreeType { treeType = BinomialTreeType_2::Joshi4 };
+        enum Strike { strikeIndependent = 0 };
         Joshi4_2(const boost::shared_ptr<StochasticProcess1D>&,
                  Time end,
                  Size steps,
                  Real strike);
         Real underlying(Size i, Size index) const {
-            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))+1)
-                       * std::pow(up_, Real(index)-1);
+            return x0_ * std::pow(down_, Real(BigInteger(i)-BigInteger(index))
+                                         +width_)
+                       * std::pow(up_, Real(index)-width_)
+                + dividendAdjustment(i);
         }
         Real probability(Size, Size, Size branch) const {
             return (branch == 1 ? pu_ : pd_);
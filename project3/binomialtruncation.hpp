@@ -0,0 +1,168 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file binomialtruncation.hpp
+    \brief Rollback restricted to the likely nodes of a binomial tree
+*/
+
+#ifndef binomial_truncation_hpp
+#define binomial_truncation_hpp
+
+#include "binomialrollback.hpp"
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <cmath>
+
+namespace QuantLib {
+
+    //! Nodes of a constant-parameter tree close to the forward
+    /*! On slice i, at time t = i*dt, the band holds the nodes whose
+        log-price (net of the escrowed dividends) is within
+        \c deviations standard deviations of the expected log-price
+        seen from the initial node,
+        \f[
+            |\log S - \log S_0 - \mu t| \le k \sigma \sqrt{t},
+        \f]
+        plus m nodes on each side, m being the number of initial
+        nodes on each side of the spot.  The initial slice is always
+        kept whole.  The band holds O(sqrt(i)) nodes, so that the
+        whole band has O(N^{3/2}) of them.
+
+        \ingroup lattices
+    */
+    class BinomialBand_2 {
+      public:
+        BinomialBand_2(const BinomialSlices_2& slices,
+                       Real drift, Volatility volatility, Time dt,
+                       Real deviations)
+        : lo_(slices.steps()+1), hi_(slices.steps()+1) {
+            QL_REQUIRE(deviations > 0.0,
+                       "positive number of deviations required");
+            // the initial middle node is at the unshifted spot
+            Size m = (slices.size(0)-1)/2;
+            Real logSpot = std::log(slices.base(0)*slices.powers()[m]);
+            Real logRatio = std::log(slices.ratio());
+            Real anchor = Real(slices.anchor());
+            for (Size i=0; i<=slices.steps(); ++i) {
+                Time t = i*dt;
+                Real width = deviations*volatility*std::sqrt(t);
+                Real center = logSpot + drift*t - std::log(slices.base(i));
+                Real lo = std::ceil((center - width)/logRatio) + anchor
+                        - Real(m);
+                Real hi = std::floor((center + width)/logRatio) + anchor
+                        + Real(m);
+                Real last = Real(slices.size(i)-1);
+                lo_[i] = (i == 0 || lo < 0.0) ? 0 : Size(std::min(lo, last));
+                hi_[i] = (i == 0 || hi > last) ?
+                    slices.size(i)-1 : Size(std::max(hi, 0.0));
+            }
+        }
+        //! first node kept on slice i
+        Size lo(Size i) const { return lo_[i]; }
+        //! last node kept on slice i
+        Size hi(Size i) const { return hi_[i]; }
+        //! total number of nodes kept
+        Size nodes() const {
+            Size n = 0;
+            for (Size i=0; i<lo_.size(); ++i)
+                n += hi_[i] - lo_[i] + 1;
+            return n;
+        }
+      private:
+        std::vector<Size> lo_, hi_;
+    };
+
+
+    //! Estimated bound on the error caused by the truncation
+    /*! A path from the initial node leaves the band at some slice
+        with probability at most 2N(-k) per slice; the value lost is
+        at most the difference between the boundary values and the
+        true ones, bounded by the larger of the strike and the
+        forward shifted by k standard deviations.
+    */
+    inline Real binomialTruncationBound(Size steps, Real deviations,
+                                        Real forward, Real strike,
+                                        Volatility volatility,
+                                        Time maturity) {
+        CumulativeNormalDistribution N;
+        Real scale = std::max(strike,
+            forward*std::exp(deviations*volatility*std::sqrt(maturity)));
+        return 2.0*steps*N(-deviations)*scale;
+    }
+
+
+    //! In-place backward induction on the nodes of a band
+    /*! Same as rollbackVanillaFrom_2, but only the nodes in the band
+        are rolled back.  Whenever a node outside the band of slice
+        i+1 is needed to compute one in the band of slice i, its
+        value is taken from \c boundary(i+1, j), e.g., the payoff or
+        an analytic approximation; this happens for O(1) nodes per
+        slice.
+
+        On entry \c values holds the values on the band of slice
+        \c from, with the buffer sized as for rollbackVanillaFrom_2;
+        on return its first slices.size(0) elements hold the values
+        at the initial nodes.  Nodes outside the band are left with
+        meaningless values.
+
+        \ingroup lattices
+    */
+    template <class F>
+    void rollbackVanillaTruncated_2(const BinomialSlices_2& slices,
+                                    const BinomialBand_2& band,
+                                    Size from,
+                                    DiscountFactor discount,
+                                    const PlainVanillaPayoff& payoff,
+                                    Size firstExerciseStep,
+                                    const F& boundary,
+                                    Array& values) {
+        QL_REQUIRE(from <= slices.steps(),
+                   "slice " << from << " past the last one ("
+                   << slices.steps() << ")");
+        QL_REQUIRE(values.size() >= slices.size(from)+detail::binomialPadding,
+                   "buffer of size " << values.size() << " given, at least "
+                   << slices.size(from)+detail::binomialPadding
+                   << " elements required");
+        Real omega = (payoff.optionType() == Option::Call ? 1.0 : -1.0);
+        detail::BinomialExercise_2 exercise = {
+            0.0, 0.0, omega, payoff.strike(), 0
+        };
+
+        Real* v = values.begin();
+        for (Size i=from; i-- > 0; ) {
+            Size lo = band.lo(i), hi = band.hi(i);
+            // nodes of slice i+1 needed here but not rolled back
+            for (Size j=lo; j<=hi+1; ++j) {
+                if (j < band.lo(i+1) || j > band.hi(i+1))
+                    v[j] = boundary(i+1, j);
+            }
+            if (i >= firstExerciseStep) {
+                exercise.base = slices.base(i);
+                exercise.shift = slices.shift(i);
+                exercise.powers = slices.powers() + lo;
+                detail::binomialStep(v+lo, hi-lo+1, slices.pu(i),
+                                     slices.pd(i), discount, &exercise);
+            } else {
+                detail::binomialStep(v+lo, hi-lo+1, slices.pu(i),
+                                     slices.pd(i), discount, 0);
+            }
+        }
+    }
+
+}
+
+
+#endif
@@ -1,19 +1,33 @@
 #include "binomialtree.hpp"
 #include "binomialengine.hpp"
+#include "binomialchain.hpp"
+#include "binomialimpliedvol.hpp"
+#include "binomialdirect.hpp"
+#include "binomialfixed.hpp"
+#include "binomialportfolio.hpp"
+#include "binomialstream.hpp"
+#include "binomialsurface.hpp"
 #include <ql/methods/lattices/tree.hpp>
 #include <ql/qldefines.hpp>
 #ifdef BOOST_MSVC
 #  include <ql/auto_link.hpp>
 #endif
 #include <ql/instruments/vanillaoption.hpp>
+#include <ql/math/randomnumbers/mt19937uniformrng.hpp>
+#include <ql/math/solvers1d/brent.hpp>
 #include <ql/time/calendars/target.hpp>
 #include <ql/utilities/dataformatters.hpp>
 #include <ql/pricingengines/vanilla/analyticeuropeanengine.hpp>
 #include <boost/timer.hpp>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <utility>
+#include <vector>
 #include <ql/methods/lattices/binomialtree.hpp>
 #include <ql/pricingengines/vanilla/binomialengine.hpp>
 
@@ -21,12 +35,118 @@
 using namespace QuantLib;
 
 
-int main() {
+/* Option-chain driver:
+
+       main <input> <output> [threads]
+           prices the chain in <input>, binary or CSV (see
+           BinomialChainPricer_2), into <output>;
+       main --generate <rows> <output> [steps]
+           writes a random chain of American and European options
+           on all trees in the binary format, e.g., for timing the
+           above on 10M rows.
+*/
+int chainDriver(int argc, char* argv[]) {
+    std::string command(argv[1]);
+    if (command == "--generate") {
+        QL_REQUIRE(argc >= 4, "usage: " << argv[0]
+                   << " --generate <rows> <output> [steps]");
+        Size rows = std::strtoul(argv[2], 0, 10);
+        std::int32_t steps = argc > 4 ? std::atoi(argv[4]) : 100;
+        MappedFile_2 file(argv[3], sizeof(BinomialChainHeader_2) +
+                                   rows*sizeof(BinomialOptionRow_2));
+        BinomialChainHeader_2* header =
+            reinterpret_cast<BinomialChainHeader_2*>(file.data());
+        std::memcpy(header->magic, BinomialChainHeader_2::rowsMagic(), 8);
+        header->rows = rows;
+        BinomialOptionRow_2* row = reinterpret_cast<BinomialOptionRow_2*>(
+                              file.data() + sizeof(BinomialChainHeader_2));
+        MersenneTwisterUniformRng rng(42);
+        for (Size k=0; k<rows; ++k, ++row) {
+            row->spot = 100.0;
+            row->strike = 70.0 + 60.0*rng.next().value;
+            row->riskFreeRate = 0.05*rng.next().value;
+            row->dividendYield = 0.03*rng.next().value;
+            row->volatility = 0.1 + 0.4*rng.next().value;
+            row->maturity = 0.1 + 1.9*rng.next().value;
+            row->type = rng.next().value < 0.5 ? Option::Call : Option::Put;
+            row->exercise = rng.next().value < 0.5 ? Exercise::American
+                                                   : Exercise::European;
+            row->tree = std::int32_t(k % (BinomialTreeType_2::Joshi4+1));
+            row->steps = steps;
+        }
+        std::cout << rows << " options written to " << argv[3] << std::endl;
+        return 0;
+    }
+
+    QL_REQUIRE(argc >= 3,
+               "usage: " << argv[0] << " <input> <output> [threads]");
+    Size threads = argc > 3 ? std::strtoul(argv[3], 0, 10)
+                            : ThreadPool_2::defaultSize();
+    boost::shared_ptr<ThreadPool_2> pool(new ThreadPool_2(threads));
+    auto starttime = std::chrono::steady_clock::now();
+    Size rows = BinomialChainPricer_2(pool).price(argv[1], argv[2]);
+    auto endtime = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = endtime-starttime;
+    std::cout << rows << " options priced on " << pool->size()
+              << " threads in " << elapsed_seconds.count() << "s ("
+              << rows/elapsed_seconds.count() << " options/s)" << std::endl;
+    return 0;
+}
+
+
+/* Median and 99th percentile of the latency of f, in nanoseconds,
+   over the given number of calls timed one by one. */
+template <class F>
+std::pair<double, double> latencyPercentiles(Size runs, const F& f) {
+    std::vector<double> latencies(runs);
+    for (Size k=0; k<runs; ++k) {
+        auto start = std::chrono::steady_clock::now();
+        f(k);
+        auto end = std::chrono::steady_clock::now();
+        latencies[k] =
+            std::chrono::duration<double, std::nano>(end-start).count();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return std::make_pair(latencies[runs/2], latencies[(runs*99)/100]);
+}
+
+
+/* Latencies of American puts on CRR trees with N steps, with the
+   number of steps given at run time and at compile time. */
+template <Size N>
+void fixedTreeLatencies(BinomialOptionInputs_2 inputs, Size runs) {
+    inputs.steps = N;
+    Real strike = inputs.strike;
+    Real workspace[2*(N + 3 + detail::binomialPadding)];
+    // keeps the results, and thus the calls, from being optimized away
+    volatile Real sink;
+    std::pair<double, double> runtime = latencyPercentiles(runs,
+        [&](Size k) {
+            inputs.strike = strike + Real(k % 21) - 10.0;
+            sink = binomialPrice_2<CoxRossRubinstein_2>(inputs,
+                                                        workspace).value;
+        });
+    std::pair<double, double> fixed = latencyPercentiles(runs,
+        [&](Size k) {
+            inputs.strike = strike + Real(k % 21) - 10.0;
+            sink = binomialPrice_2<CoxRossRubinstein_2, N>(inputs).value;
+        });
+    std::cout << N << " steps: run-time size p50 " << runtime.first
+              << "ns, p99 " << runtime.second << "ns; compile-time size p50 "
+              << fixed.first << "ns, p99 " << fixed.second << "ns"
+              << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
 
 
 
     try {
 
+        if (argc > 1)
+            return chainDriver(argc, argv);
+
         // Date
         Calendar calendar = TARGET();
         Date todaysDate(8, Mar, 2020);
@@ -475,7 +595,1038 @@ int main() {
         std::cout << "Option Price: " << europeanOption.NPV() << "\n";
         std::cout << std::endl ;
 
-        
+
+
+
+        // Rollback kernels
+        std::cout << "Rollback benchmark (American put, "
+                  << detail::binomialStepInstructionSet() << "): " << std::endl;
+        std::cout << std::endl ;
+
+        Time maturityTime = dayCounter.yearFraction(settlementDate, maturity);
+        PlainVanillaPayoff putPayoff(Option::Put, strike);
+        Size benchmarkSteps[] = { 1000, 10000, 50000 };
+
+        for (Size k=0; k<3; ++k) {
+            Size n = benchmarkSteps[k];
+            CoxRossRubinstein_2 tree(bsmProcess, maturityTime, n, strike);
+            DiscountFactor discount = std::exp(-riskFreeRate*maturityTime/n);
+
+            auto starttimeScalar = std::chrono::system_clock::now();
+
+            Array scalarValues(tree.size(n));
+            rollbackVanilla_2(tree, n, discount, putPayoff, 0, scalarValues);
+
+            auto endtimeScalar = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsScalar = endtimeScalar-starttimeScalar;
+
+            auto starttimeSimd = std::chrono::system_clock::now();
+
+            BinomialSlices_2 slices(tree, n);
+            Array simdValues;
+            rollbackVanilla_2(slices, discount, putPayoff, 0, simdValues);
+
+            auto endtimeSimd = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsSimd = endtimeSimd-starttimeSimd;
+
+            std::cout << "Steps: " << n << std::endl;
+            std::cout << "Scalar rollback time: " << elapsed_secondsScalar.count() << "s\n";
+            std::cout << "Vectorized rollback time: " << elapsed_secondsSimd.count() << "s\n";
+            std::cout << "Option Price: " << scalarValues[1] << " (scalar), "
+                      << simdValues[1] << " (vectorized)\n";
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // Multithreaded rollback
+        boost::shared_ptr<ThreadPool_2> pool(new ThreadPool_2);
+        std::cout << "Multithreaded rollback (American put, 50000 steps, "
+                  << pool->size() << " threads): " << std::endl;
+        std::cout << std::endl ;
+
+        boost::shared_ptr<Exercise> americanExercise(
+                                new AmericanExercise(settlementDate, maturity));
+        boost::shared_ptr<StrikedTypePayoff> americanPayoff(
+                                new PlainVanillaPayoff(Option::Put, strike));
+        VanillaOption americanOption(americanPayoff, americanExercise);
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+            .withSteps(50000));
+
+        auto starttimeSerial = std::chrono::system_clock::now();
+
+        Real serialPrice = americanOption.NPV();
+
+        auto endtimeSerial = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsSerial = endtimeSerial-starttimeSerial;
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+            .withSteps(50000)
+            .withThreadPool(pool));
+
+        auto starttimeParallel = std::chrono::system_clock::now();
+
+        Real parallelPrice = americanOption.NPV();
+
+        auto endtimeParallel = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsParallel = endtimeParallel-starttimeParallel;
+
+        std::cout << "Serial time: " << elapsed_secondsSerial.count() << "s\n";
+        std::cout << "Parallel time: " << elapsed_secondsParallel.count() << "s\n";
+        std::cout << "Speedup: "
+                  << elapsed_secondsSerial.count()/elapsed_secondsParallel.count() << "\n";
+        std::cout << "Option Price: " << std::setprecision(12) << serialPrice
+                  << " (serial), " << parallelPrice << " (parallel), "
+                  << (serialPrice == parallelPrice ? "identical" : "different")
+                  << std::setprecision(6) << "\n";
+        std::cout << std::endl ;
+        std::cout << std::endl ;
+
+
+
+
+        // Temporal tiling
+        std::cout << "Cache-blocked rollback (American put, 128 slices x 4096 nodes tiles): "
+                  << std::endl;
+        std::cout << std::endl ;
+
+        Size tilingSteps[] = { 10000, 50000, 200000 };
+        for (Size k=0; k<3; ++k) {
+            Size n = tilingSteps[k];
+            CoxRossRubinstein_2 tree(bsmProcess, maturityTime, n, strike);
+            BinomialSlices_2 slices(tree, n);
+            DiscountFactor discount = std::exp(-riskFreeRate*maturityTime/n);
+
+            auto starttimeNaive = std::chrono::system_clock::now();
+
+            Array naiveValues;
+            rollbackVanilla_2(slices, discount, putPayoff, 0, naiveValues, 1, 0);
+
+            auto endtimeNaive = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsNaive = endtimeNaive-starttimeNaive;
+
+            auto starttimeTiled = std::chrono::system_clock::now();
+
+            Array tiledValues;
+            rollbackVanilla_2(slices, discount, putPayoff, 0, tiledValues, 128, 4096);
+
+            auto endtimeTiled = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsTiled = endtimeTiled-starttimeTiled;
+
+            // bytes streamed from memory once the slices no longer fit in
+            // cache: one read and one write per node and per slice for the
+            // plain loop, per block of slices (plus the nodes above each
+            // tile) for the tiled one
+            Real naiveBytes = 0.0, tiledBytes = 0.0;
+            for (Size i=n; i>0; --i)
+                naiveBytes += 2.0*sizeof(Real)*slices.size(i-1);
+            for (Size i=n; i>0 && slices.size(i)>4096; ) {
+                Size block = std::min<Size>(128, i);
+                Size nodes = slices.size(i-block);
+                Size tiles = (nodes+4095)/4096;
+                tiledBytes += sizeof(Real)*(2.0*nodes + tiles*block);
+                i -= block;
+            }
+
+            std::cout << "Steps: " << n << std::endl;
+            std::cout << "Slice loop time: " << elapsed_secondsNaive.count() << "s\n";
+            std::cout << "Tiled time: " << elapsed_secondsTiled.count() << "s\n";
+            std::cout << "Memory traffic: " << naiveBytes/1.0e9 << " GB (slice loop), "
+                      << tiledBytes/1.0e9 << " GB (tiled), "
+                      << naiveBytes/tiledBytes << "x less\n";
+            std::cout << "Option Price: " << tiledValues[1]
+                      << (tiledValues[1] == naiveValues[1] ? " (identical)" : " (different)")
+                      << "\n";
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // European closed form
+        std::cout << "European put, rollback vs sum over terminal nodes: "
+                  << std::endl;
+        std::cout << std::endl ;
+
+        for (Size k=0; k<3; ++k) {
+            Size n = benchmarkSteps[k];
+            CoxRossRubinstein_2 tree(bsmProcess, maturityTime, n, strike);
+            DiscountFactor discount = std::exp(-riskFreeRate*maturityTime/n);
+
+            auto starttimeRollback = std::chrono::system_clock::now();
+
+            BinomialSlices_2 slices(tree, n);
+            Array rollbackValues;
+            rollbackVanilla_2(slices, discount, putPayoff, n, rollbackValues);
+
+            auto endtimeRollback = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsRollback = endtimeRollback-starttimeRollback;
+
+            auto starttimeSum = std::chrono::system_clock::now();
+
+            Array sumValues;
+            europeanVanilla_2(tree, n, discount, putPayoff, sumValues);
+
+            auto endtimeSum = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsSum = endtimeSum-starttimeSum;
+
+            std::cout << "Steps: " << n << std::endl;
+            std::cout << "Rollback time: " << elapsed_secondsRollback.count() << "s\n";
+            std::cout << "Terminal sum time: " << elapsed_secondsSum.count() << "s\n";
+            std::cout << "Option Price: " << rollbackValues[1] << " (rollback), "
+                      << sumValues[1] << " (terminal sum)\n";
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // American put for the accelerated trees below: deeper in the
+        // money and more volatile than the one above, at a higher rate,
+        // so that early exercise matters.  The reference is the
+        // smoothed and extrapolated price on 50000 steps.
+        Real testStrike = 105.0;
+        Rate testRate = 0.05;
+        Volatility testVolatility = 0.30;
+        boost::shared_ptr<BlackScholesMertonProcess> testProcess(
+            new BlackScholesMertonProcess(
+                underlyingH, flatDividendTS,
+                Handle<YieldTermStructure>(
+                    boost::shared_ptr<YieldTermStructure>(
+                        new FlatForward(settlementDate, testRate,
+                                        dayCounter))),
+                Handle<BlackVolTermStructure>(
+                    boost::shared_ptr<BlackVolTermStructure>(
+                        new BlackConstantVol(settlementDate, calendar,
+                                             testVolatility, dayCounter)))));
+        boost::shared_ptr<StrikedTypePayoff> testPayoff(
+                                new PlainVanillaPayoff(Option::Put, testStrike));
+        VanillaOption testOption(testPayoff, americanExercise);
+        testOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(testProcess)
+            .withSteps(50000)
+            .withSmoothing(BinomialSmoothing_2::Richardson));
+        Real testReference = testOption.NPV();
+
+
+
+        // Smoothing and Richardson extrapolation
+        std::cout << "Smoothing (American put, strike " << testStrike
+                  << ", volatility " << io::volatility(testVolatility)
+                  << ", rate " << io::rate(testRate)
+                  << "), error against BBSR on 50000 steps: " << std::endl;
+        std::cout << std::endl ;
+
+        Size smoothingSteps[] = { 100, 200, 400, 5000 };
+        BinomialSmoothing_2::Type smoothings[] = {
+            BinomialSmoothing_2::None,
+            BinomialSmoothing_2::BlackScholes,
+            BinomialSmoothing_2::Richardson
+        };
+        std::string smoothingNames[] = { "raw", "BBS", "BBSR" };
+
+        for (Size k=0; k<4; ++k) {
+            std::cout << "Steps: " << smoothingSteps[k] << std::endl;
+            for (Size m=0; m<3; ++m) {
+                testOption.setPricingEngine(
+                    MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(testProcess)
+                    .withSteps(smoothingSteps[k])
+                    .withSmoothing(smoothings[m]));
+
+                auto starttimeSmoothing = std::chrono::system_clock::now();
+
+                Real smoothedPrice = testOption.NPV();
+
+                auto endtimeSmoothing = std::chrono::system_clock::now();
+                std::chrono::duration<double> elapsed_secondsSmoothing = endtimeSmoothing-starttimeSmoothing;
+
+                std::cout << smoothingNames[m] << ": "
+                          << "Option Price: " << smoothedPrice
+                          << ", Error: " << std::fabs(smoothedPrice-testReference)
+                          << ", Delta: " << testOption.delta()
+                          << ", Gamma: " << testOption.gamma()
+                          << ", Time: " << elapsed_secondsSmoothing.count() << "s\n";
+            }
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // Strike-aligned tree
+        Real offStrike = 108.0;
+        Rate offRate = 0.05;
+        Spread offDividendYield = 0.01;
+        Volatility offVolatility = 0.25;
+        std::cout << "Strike-aligned tree (European call, strike " << offStrike
+                  << ", volatility " << io::volatility(offVolatility)
+                  << "), error against Black-Scholes: " << std::endl;
+        std::cout << std::endl ;
+
+        boost::shared_ptr<BlackScholesMertonProcess> offProcess(
+            new BlackScholesMertonProcess(
+                underlyingH,
+                Handle<YieldTermStructure>(
+                    boost::shared_ptr<YieldTermStructure>(
+                        new FlatForward(settlementDate, offDividendYield,
+                                        dayCounter))),
+                Handle<YieldTermStructure>(
+                    boost::shared_ptr<YieldTermStructure>(
+                        new FlatForward(settlementDate, offRate,
+                                        dayCounter))),
+                Handle<BlackVolTermStructure>(
+                    boost::shared_ptr<BlackVolTermStructure>(
+                        new BlackConstantVol(settlementDate, calendar,
+                                             offVolatility, dayCounter)))));
+        boost::shared_ptr<StrikedTypePayoff> offPayoff(
+                                new PlainVanillaPayoff(Option::Call, offStrike));
+        VanillaOption offOption(offPayoff, europeanExercise);
+        offOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                        new AnalyticEuropeanEngine(offProcess)));
+        Real offReference = offOption.NPV();
+
+        // doubling the steps halves the strike-aligned error; the CRR
+        // one oscillates, as shown by the odd number of steps
+        for (Size k=100; k<=1600; k*=2) {
+            for (Size n=k; n<=k+1; ++n) {
+                offOption.setPricingEngine(
+                    MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(offProcess)
+                    .withSteps(n));
+                Real crrError = offOption.NPV() - offReference;
+                offOption.setPricingEngine(
+                    MakeBinomialVanillaEngine_2<StrikeAligned_2>(offProcess)
+                    .withSteps(n));
+                Real alignedError = offOption.NPV() - offReference;
+                std::cout << "Steps: " << n
+                          << ", CRR error: " << crrError
+                          << ", Strike-aligned error: " << alignedError << "\n";
+            }
+        }
+        std::cout << std::endl ;
+        std::cout << std::endl ;
+
+
+
+
+        // Truncated lattice
+        std::cout << "Truncated lattice (American put): " << std::endl;
+        std::cout << std::endl ;
+
+        Size truncationSteps[] = { 10000, 50000 };
+        Real truncations[] = { 6.0, 8.0 };
+
+        for (Size k=0; k<2; ++k) {
+            Size n = truncationSteps[k];
+            americanOption.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(n));
+
+            auto starttimeFull = std::chrono::system_clock::now();
+
+            Real fullPrice = americanOption.NPV();
+
+            auto endtimeFull = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsFull = endtimeFull-starttimeFull;
+
+            std::cout << "Steps: " << n << std::endl;
+            std::cout << "Full lattice time: " << elapsed_secondsFull.count() << "s\n";
+
+            for (Size m=0; m<2; ++m) {
+                americanOption.setPricingEngine(
+                    MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                    .withSteps(n)
+                    .withTruncation(truncations[m]));
+
+                auto starttimeTruncated = std::chrono::system_clock::now();
+
+                Real truncatedPrice = americanOption.NPV();
+
+                auto endtimeTruncated = std::chrono::system_clock::now();
+                std::chrono::duration<double> elapsed_secondsTruncated = endtimeTruncated-starttimeTruncated;
+
+                std::cout << truncations[m] << " deviations: "
+                          << "Time: " << elapsed_secondsTruncated.count() << "s"
+                          << ", Speedup: "
+                          << elapsed_secondsFull.count()/elapsed_secondsTruncated.count()
+                          << ", Error: " << std::fabs(truncatedPrice-fullPrice)
+                          << ", Error bound: "
+                          << americanOption.result<Real>("truncationBound") << "\n";
+            }
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // Adaptive mesh
+        std::cout << "Adaptive mesh (American put, strike " << testStrike
+                  << ", volatility " << io::volatility(testVolatility)
+                  << ", rate " << io::rate(testRate)
+                  << "), error against BBSR on 50000 steps: " << std::endl;
+        std::cout << std::endl ;
+
+        Size meshSteps[] = { 50, 100, 200, 400 };
+        std::string meshNames[] = { "CRR", "LR", "CRR + AMM", "CRR + AMM + Richardson" };
+
+        for (Size k=0; k<4; ++k) {
+            Size n = meshSteps[k];
+            boost::shared_ptr<PricingEngine> meshEngines[] = {
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(testProcess)
+                    .withSteps(n),
+                MakeBinomialVanillaEngine_2<LeisenReimer_2>(testProcess)
+                    .withSteps(n),
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(testProcess)
+                    .withSteps(n)
+                    .withAdaptiveMesh(4),
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(testProcess)
+                    .withSteps(n)
+                    .withAdaptiveMesh(4)
+                    .withSmoothing(BinomialSmoothing_2::Richardson)
+            };
+
+            std::cout << "Steps: " << n << std::endl;
+            for (Size m=0; m<4; ++m) {
+                testOption.setPricingEngine(meshEngines[m]);
+
+                auto starttimeMesh = std::chrono::system_clock::now();
+
+                Real meshPrice = testOption.NPV();
+
+                auto endtimeMesh = std::chrono::system_clock::now();
+                std::chrono::duration<double> elapsed_secondsMesh = endtimeMesh-starttimeMesh;
+
+                std::cout << meshNames[m] << ": "
+                          << "Error: " << std::fabs(meshPrice-testReference)
+                          << ", Time: " << elapsed_secondsMesh.count() << "s\n";
+            }
+            std::cout << std::endl ;
+        }
+        std::cout << std::endl ;
+
+
+
+
+        // Strike chain
+        std::cout << "Strike chain (100 American puts, 1000 steps): "
+                  << std::endl;
+        std::cout << std::endl ;
+
+        Size chainSteps = 1000;
+        std::vector<PlainVanillaPayoff> chainPayoffs;
+        for (Size k=0; k<100; ++k)
+            chainPayoffs.push_back(
+                PlainVanillaPayoff(Option::Put, 50.0 + k));
+
+        boost::shared_ptr<PricingEngine> chainEngine =
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(chainSteps);
+
+        auto starttimeSingle = std::chrono::system_clock::now();
+
+        std::vector<Real> singlePrices;
+        for (Size k=0; k<chainPayoffs.size(); ++k) {
+            VanillaOption option(
+                boost::shared_ptr<StrikedTypePayoff>(
+                    new PlainVanillaPayoff(chainPayoffs[k])),
+                americanExercise);
+            option.setPricingEngine(chainEngine);
+            singlePrices.push_back(option.NPV());
+        }
+
+        auto endtimeSingle = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsSingle = endtimeSingle-starttimeSingle;
+
+        auto starttimeChain = std::chrono::system_clock::now();
+
+        BinomialVanillaChain_2<CoxRossRubinstein_2> chain(
+            bsmProcess, americanExercise, chainSteps);
+        chain.calculate(chainPayoffs);
+
+        auto endtimeChain = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsChain = endtimeChain-starttimeChain;
+
+        Real chainDifference = 0.0;
+        for (Size k=0; k<chain.size(); ++k)
+            chainDifference = std::max(chainDifference,
+                                       std::fabs(chain.value(k)-singlePrices[k]));
+
+        std::cout << "One engine per option: "
+                  << elapsed_secondsSingle.count() << "s\n";
+        std::cout << "Single chain: "
+                  << elapsed_secondsChain.count() << "s\n";
+        std::cout << "Max difference: " << chainDifference << "\n";
+        std::cout << std::endl ;
+
+
+
+
+        // Multi-maturity strip
+        std::cout << "Monthly expiries (12 American puts, 100 steps per month): "
+                  << std::endl;
+        std::cout << std::endl ;
+
+        Date horizon = settlementDate + 12*Months;
+        Size stripSteps = 1200;
+        std::vector<PlainVanillaPayoff> stripPayoffs;
+        std::vector<boost::shared_ptr<Exercise> > stripExercises;
+        for (Size k=1; k<=12; ++k) {
+            stripPayoffs.push_back(PlainVanillaPayoff(Option::Put, strike));
+            stripExercises.push_back(boost::shared_ptr<Exercise>(
+                new AmericanExercise(settlementDate,
+                                     settlementDate + k*Months)));
+        }
+
+        auto starttimeExpiries = std::chrono::system_clock::now();
+
+        std::vector<Real> expiryPrices;
+        for (Size k=0; k<stripPayoffs.size(); ++k) {
+            VanillaOption option(
+                boost::shared_ptr<StrikedTypePayoff>(
+                    new PlainVanillaPayoff(stripPayoffs[k])),
+                stripExercises[k]);
+            // same time step as the strip
+            Time t = bsmProcess->time(stripExercises[k]->lastDate());
+            Size n = Size(stripSteps*t/bsmProcess->time(horizon) + 0.5);
+            option.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                    .withSteps(n));
+            expiryPrices.push_back(option.NPV());
+        }
+
+        auto endtimeExpiries = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsExpiries = endtimeExpiries-starttimeExpiries;
+
+        auto starttimeStrip = std::chrono::system_clock::now();
+
+        BinomialVanillaChain_2<CoxRossRubinstein_2> strip(
+            bsmProcess, horizon, stripSteps);
+        strip.calculate(stripPayoffs, stripExercises);
+
+        auto endtimeStrip = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsStrip = endtimeStrip-starttimeStrip;
+
+        Real stripDifference = 0.0;
+        for (Size k=0; k<strip.size(); ++k)
+            stripDifference = std::max(stripDifference,
+                                       std::fabs(strip.value(k)-expiryPrices[k]));
+
+        std::cout << "One engine per expiry: "
+                  << elapsed_secondsExpiries.count() << "s\n";
+        std::cout << "Single sweep: "
+                  << elapsed_secondsStrip.count() << "s\n";
+        std::cout << "Max difference: " << stripDifference
+                  << " (expiries off the common grid are moved to it)\n";
+        std::cout << std::endl ;
+
+
+
+
+        // Scenario Greeks
+        std::cout << "Scenario Greeks (American put, 2000 steps): "
+                  << std::endl;
+        std::cout << std::endl ;
+
+        Size scenarioSteps = 2000;
+        Volatility volBump = 1.0e-3;
+        Rate rateBump = 1.0e-4;
+
+        auto starttimeBumped = std::chrono::system_clock::now();
+
+        // one engine per bumped market
+        Real bumped[5];
+        Volatility bumpedVols[] = { volatility, volatility+volBump,
+                                    volatility-volBump, volatility,
+                                    volatility };
+        Rate bumpedRates[] = { riskFreeRate, riskFreeRate, riskFreeRate,
+                               riskFreeRate+rateBump, riskFreeRate-rateBump };
+        for (Size k=0; k<5; ++k) {
+            boost::shared_ptr<BlackScholesMertonProcess> bumpedProcess(
+                new BlackScholesMertonProcess(
+                    underlyingH, flatDividendTS,
+                    Handle<YieldTermStructure>(
+                        boost::shared_ptr<YieldTermStructure>(
+                            new FlatForward(settlementDate, bumpedRates[k],
+                                            dayCounter))),
+                    Handle<BlackVolTermStructure>(
+                        boost::shared_ptr<BlackVolTermStructure>(
+                            new BlackConstantVol(settlementDate, calendar,
+                                                 bumpedVols[k],
+                                                 dayCounter)))));
+            americanOption.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bumpedProcess)
+                    .withSteps(scenarioSteps));
+            bumped[k] = americanOption.NPV();
+        }
+        Real bumpedVega = (bumped[1]-bumped[2])/(2.0*volBump);
+        Real bumpedRho = (bumped[3]-bumped[4])/(2.0*rateBump);
+
+        auto endtimeBumped = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsBumped = endtimeBumped-starttimeBumped;
+
+        auto starttimeLanes = std::chrono::system_clock::now();
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(scenarioSteps)
+                .withScenarioGreeks(volBump, rateBump));
+        Real lanesVega = americanOption.vega();
+        Real lanesRho = americanOption.rho();
+
+        auto endtimeLanes = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsLanes = endtimeLanes-starttimeLanes;
+
+        std::cout << "Bumped engines: Vega: " << bumpedVega
+                  << ", Rho: " << bumpedRho
+                  << ", Time: " << elapsed_secondsBumped.count() << "s\n";
+        std::cout << "Scenario lanes: Vega: " << lanesVega
+                  << ", Rho: " << lanesRho
+                  << ", Dividend rho: " << americanOption.dividendRho()
+                  << ", Time: " << elapsed_secondsLanes.count() << "s\n";
+        std::cout << std::endl ;
+
+        auto starttimeAdjoint = std::chrono::system_clock::now();
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(scenarioSteps)
+                .withAdjointGreeks());
+        Real adjointVega = americanOption.vega();
+        Real adjointRho = americanOption.rho();
+
+        auto endtimeAdjoint = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsAdjoint = endtimeAdjoint-starttimeAdjoint;
+
+        std::cout << "Adjoint: Vega: " << adjointVega
+                  << ", Rho: " << adjointRho
+                  << ", Dividend rho: " << americanOption.dividendRho()
+                  << ", Strike: "
+                  << americanOption.result<Real>("strikeSensitivity")
+                  << ", Time: " << elapsed_secondsAdjoint.count() << "s\n";
+        std::cout << std::endl ;
+
+        // repeated requests on an unchanged market
+        Size repeatedRequests = 20;
+
+        auto starttimeFresh = std::chrono::system_clock::now();
+        Real freshPrice = 0.0;
+        for (Size k=0; k<repeatedRequests; ++k) {
+            americanOption.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                    .withSteps(timeSteps));
+            freshPrice = americanOption.NPV();
+        }
+        auto endtimeFresh = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsFresh = endtimeFresh-starttimeFresh;
+
+        auto starttimeCached = std::chrono::system_clock::now();
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(timeSteps));
+        Real cachedPrice = 0.0;
+        for (Size k=0; k<repeatedRequests; ++k) {
+            americanOption.recalculate();
+            cachedPrice = americanOption.NPV();
+        }
+        auto endtimeCached = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsCached = endtimeCached-starttimeCached;
+
+        std::cout << "Fresh engines: " << freshPrice
+                  << ", Time: " << elapsed_secondsFresh.count() << "s\n";
+        std::cout << "Cached trees: " << cachedPrice
+                  << ", Time: " << elapsed_secondsCached.count() << "s\n";
+        std::cout << std::endl ;
+
+        // spot ladder of 2m+1 levels from one rollback
+        Size ladderWidth = 5;
+
+        auto starttimeLadder = std::chrono::system_clock::now();
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(timeSteps)
+                .withSpotLadder(ladderWidth));
+        std::vector<Real> ladderSpots =
+            americanOption.result<std::vector<Real> >("spotLadder");
+        std::vector<Real> ladderValues =
+            americanOption.result<std::vector<Real> >("spotLadderValues");
+        auto endtimeLadder = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsLadder = endtimeLadder-starttimeLadder;
+
+        // the same levels, one bumped pricing each
+        auto starttimeLevels = std::chrono::system_clock::now();
+        std::vector<Real> levelValues(ladderSpots.size());
+        for (Size j=0; j<ladderSpots.size(); ++j) {
+            boost::shared_ptr<BlackScholesMertonProcess> levelProcess(
+                new BlackScholesMertonProcess(
+                    Handle<Quote>(boost::shared_ptr<Quote>(
+                                      new SimpleQuote(ladderSpots[j]))),
+                    flatDividendTS, flatTermStructure, flatVolTS));
+            americanOption.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(levelProcess)
+                    .withSteps(timeSteps));
+            levelValues[j] = americanOption.NPV();
+        }
+        auto endtimeLevels = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsLevels = endtimeLevels-starttimeLevels;
+
+        Real ladderError = 0.0;
+        for (Size j=0; j<ladderSpots.size(); ++j)
+            ladderError = std::max(ladderError,
+                                   std::fabs(ladderValues[j]-levelValues[j]));
+        std::cout << "Spot ladder (" << ladderSpots.size() << " levels from "
+                  << ladderSpots.front() << " to " << ladderSpots.back()
+                  << "): Time: " << elapsed_secondsLadder.count() << "s\n";
+        std::cout << "Separate pricings: Time: "
+                  << elapsed_secondsLevels.count() << "s"
+                  << ", Max difference: " << ladderError << "\n";
+        std::cout << std::endl ;
+
+        // anytime pricing: doubling the steps within a time budget or
+        // until a target error is reached
+        std::vector<Time> budgets = { 200.0e-6, 2.0e-3, 20.0e-3 };
+        for (Size k=0; k<budgets.size(); ++k) {
+            auto starttimeBudget = std::chrono::system_clock::now();
+            americanOption.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                    .withSteps(25)
+                    .withSmoothing(BinomialSmoothing_2::BlackScholes)
+                    .withTimeBudget(budgets[k]));
+            Real budgetPrice = americanOption.NPV();
+            auto endtimeBudget = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsBudget = endtimeBudget-starttimeBudget;
+            std::cout << "Time budget " << budgets[k] << "s: " << budgetPrice
+                      << ", Steps: "
+                      << americanOption.result<Size>("timeSteps");
+            // no estimate if the budget only allowed the first price
+            if (americanOption.additionalResults().count("estimatedError"))
+                std::cout << ", Estimated error: "
+                          << americanOption.result<Real>("estimatedError");
+            std::cout << ", Time: " << elapsed_secondsBudget.count() << "s\n";
+        }
+
+        auto starttimeTarget = std::chrono::system_clock::now();
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(25)
+                .withSmoothing(BinomialSmoothing_2::BlackScholes)
+                .withTargetError(1.0e-4));
+        Real targetPrice = americanOption.NPV();
+        auto endtimeTarget = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsTarget = endtimeTarget-starttimeTarget;
+        std::cout << "Target error 1e-4: " << targetPrice
+                  << ", Steps: " << americanOption.result<Size>("timeSteps")
+                  << ", Estimated error: "
+                  << americanOption.result<Real>("estimatedError")
+                  << ", Time: " << elapsed_secondsTarget.count() << "s\n";
+        std::cout << std::endl ;
+
+        // early-exercise boundary, reused after a small move in the spot
+        boost::shared_ptr<SimpleQuote> boundarySpot(new SimpleQuote(underlying));
+        boost::shared_ptr<BlackScholesMertonProcess> boundaryProcess(
+            new BlackScholesMertonProcess(Handle<Quote>(boundarySpot),
+                                          flatDividendTS, flatTermStructure,
+                                          flatVolTS));
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(boundaryProcess)
+                .withSteps(scenarioSteps)
+                .withExerciseBoundary());
+        Real boundaryPrice = americanOption.NPV();
+        std::vector<Real> criticalPrices =
+            americanOption.result<std::vector<Real> >("exerciseBoundary");
+        std::vector<Time> criticalTimes =
+            americanOption.result<std::vector<Time> >("exerciseBoundaryTimes");
+        std::cout << "Exercise boundary: " << boundaryPrice << "\n";
+        for (Size i=0; i<scenarioSteps; i+=scenarioSteps/4)
+            std::cout << "  t = " << criticalTimes[i] << ": exercise below "
+                      << criticalPrices[i] << "\n";
+
+        boundarySpot->setValue(underlying*1.005);
+        auto starttimeGuided = std::chrono::system_clock::now();
+        Real guidedPrice = americanOption.NPV();
+        auto endtimeGuided = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsGuided = endtimeGuided-starttimeGuided;
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(boundaryProcess)
+                .withSteps(scenarioSteps));
+        auto starttimeUnguided = std::chrono::system_clock::now();
+        Real unguidedPrice = americanOption.NPV();
+        auto endtimeUnguided = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsUnguided = endtimeUnguided-starttimeUnguided;
+
+        std::cout << "Repricing with the boundary: " << guidedPrice
+                  << ", Time: " << elapsed_secondsGuided.count() << "s\n";
+        std::cout << "Repricing without: " << unguidedPrice
+                  << ", Time: " << elapsed_secondsUnguided.count() << "s\n";
+        std::cout << std::endl ;
+
+        // value surface kept from a full rollback and saved; requests
+        // a day later at nearby spots are served from the saved copy
+        Real surfaceRange = 0.02;
+        boost::shared_ptr<BinomialValueSurface_2> surface(
+            new BinomialValueSurface_2(2.0/365, surfaceRange));
+        boost::shared_ptr<SimpleQuote> surfaceSpot(new SimpleQuote(underlying));
+        boost::shared_ptr<BlackScholesMertonProcess> surfaceProcess(
+            new BlackScholesMertonProcess(Handle<Quote>(surfaceSpot),
+                                          flatDividendTS, flatTermStructure,
+                                          flatVolTS));
+        // enough initial nodes to cover the spot range
+        Time surfaceMaturity = dayCounter.yearFraction(settlementDate,
+                                                       maturity);
+        Size surfaceLadder = Size(std::ceil(
+            surfaceRange/(volatility*std::sqrt(surfaceMaturity/scenarioSteps))))
+            + 2;
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(surfaceProcess)
+                .withSteps(scenarioSteps)
+                .withSpotLadder(surfaceLadder)
+                .withValueSurface(surface));
+        auto starttimeSurface = std::chrono::system_clock::now();
+        Real surfacePrice = americanOption.NPV();
+        auto endtimeSurface = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsSurface = endtimeSurface-starttimeSurface;
+        surface->save("valuesurface.bin");
+        std::cout << "Value surface: " << surfacePrice << ", Slices: "
+                  << surface->slices() << ", Nodes: " << surface->nodes()
+                  << ", Time: " << elapsed_secondsSurface.count() << "s\n";
+
+        Date nextDay = settlementDate + 1;
+        boost::shared_ptr<BlackScholesMertonProcess> nextDayProcess(
+            new BlackScholesMertonProcess(
+                Handle<Quote>(surfaceSpot),
+                Handle<YieldTermStructure>(
+                    boost::shared_ptr<YieldTermStructure>(
+                        new FlatForward(nextDay, dividendYield, dayCounter))),
+                Handle<YieldTermStructure>(
+                    boost::shared_ptr<YieldTermStructure>(
+                        new FlatForward(nextDay, riskFreeRate, dayCounter))),
+                Handle<BlackVolTermStructure>(
+                    boost::shared_ptr<BlackVolTermStructure>(
+                        new BlackConstantVol(nextDay, calendar, volatility,
+                                             dayCounter)))));
+        boost::shared_ptr<BinomialValueSurface_2> savedSurface(
+            new BinomialValueSurface_2("valuesurface.bin"));
+        VanillaOption servedOption(americanPayoff, americanExercise);
+        servedOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(nextDayProcess)
+                .withSteps(scenarioSteps)
+                .withSpotLadder(surfaceLadder)
+                .withValueSurface(savedSurface));
+        VanillaOption repricedOption(americanPayoff, americanExercise);
+        repricedOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(nextDayProcess)
+                .withSteps(scenarioSteps)
+                .withSpotLadder(surfaceLadder));
+        Real surfaceMoves[] = { -0.015, -0.004, 0.006, 0.012 };
+        for (Size k=0; k<sizeof(surfaceMoves)/sizeof(surfaceMoves[0]); ++k) {
+            surfaceSpot->setValue(underlying*(1.0 + surfaceMoves[k]));
+            auto starttimeServed = std::chrono::system_clock::now();
+            Real servedPrice = servedOption.NPV();
+            Real servedDelta = servedOption.delta();
+            auto endtimeServed = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsServed = endtimeServed-starttimeServed;
+            auto starttimeRepriced = std::chrono::system_clock::now();
+            Real repricedPrice = repricedOption.NPV();
+            Real repricedDelta = repricedOption.delta();
+            auto endtimeRepriced = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_secondsRepriced = endtimeRepriced-starttimeRepriced;
+            std::cout << "Next day, spot " << surfaceSpot->value()
+                      << (servedOption.additionalResults().count(
+                              "valueSurfaceElapsed") ? " (surface)"
+                                                     : " (repriced)")
+                      << ": " << servedPrice << ", Delta: " << servedDelta
+                      << ", Time: " << elapsed_secondsServed.count()
+                      << "s; full rollback: " << repricedPrice
+                      << ", Delta: " << repricedDelta
+                      << ", Time: " << elapsed_secondsRepriced.count()
+                      << "s\n";
+        }
+        std::cout << std::endl ;
+
+        // implied volatilities of a chain of American quotes
+        Size ivSteps = 500;
+        boost::shared_ptr<SimpleQuote> rootVol(new SimpleQuote(volatility));
+        boost::shared_ptr<BlackScholesMertonProcess> rootProcess(
+            new BlackScholesMertonProcess(underlyingH, flatDividendTS,
+                flatTermStructure,
+                Handle<BlackVolTermStructure>(
+                    boost::shared_ptr<BlackVolTermStructure>(
+                        new BlackConstantVol(settlementDate, calendar,
+                                             Handle<Quote>(rootVol),
+                                             dayCounter)))));
+        std::vector<PlainVanillaPayoff> ivPayoffs;
+        std::vector<Volatility> ivTrue;
+        std::vector<Real> ivPrices;
+        for (Real k=80.0; k<=120.0; k+=1.0) {
+            ivPayoffs.push_back(PlainVanillaPayoff(Option::Put, k));
+            ivTrue.push_back(volatility + 0.1*std::fabs(k-strike)/strike);
+            VanillaOption option(
+                boost::shared_ptr<StrikedTypePayoff>(
+                    new PlainVanillaPayoff(ivPayoffs.back())),
+                americanExercise);
+            option.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(rootProcess)
+                    .withSteps(ivSteps));
+            rootVol->setValue(ivTrue.back());
+            ivPrices.push_back(option.NPV());
+        }
+        std::vector<boost::shared_ptr<Exercise> > ivExercises(
+                                            ivPayoffs.size(), americanExercise);
+
+        auto starttimeBatch = std::chrono::system_clock::now();
+        BinomialImpliedVolatility_2<CoxRossRubinstein_2> impliedVols(
+            bsmProcess, ivSteps, DividendSchedule(), pool);
+        impliedVols.calculate(ivPayoffs, ivExercises, ivPrices);
+        auto endtimeBatch = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsBatch = endtimeBatch-starttimeBatch;
+
+        // the same quotes with a generic root finder around the engine
+        auto starttimeRoot = std::chrono::system_clock::now();
+        std::vector<Volatility> rootVols;
+        for (Size k=0; k<ivPayoffs.size(); ++k) {
+            VanillaOption option(
+                boost::shared_ptr<StrikedTypePayoff>(
+                    new PlainVanillaPayoff(ivPayoffs[k])),
+                americanExercise);
+            option.setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(rootProcess)
+                    .withSteps(ivSteps));
+            Brent solver;
+            solver.setMaxEvaluations(100);
+            Real target = ivPrices[k];
+            rootVols.push_back(solver.solve(
+                [&](Volatility v) {
+                    rootVol->setValue(v);
+                    return option.NPV() - target;
+                },
+                1.0e-4, volatility, 1.0e-4, 4.0));
+        }
+        auto endtimeRoot = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsRoot = endtimeRoot-starttimeRoot;
+
+        Real ivError = 0.0, rootError = 0.0;
+        Size ivEvaluations = 0;
+        for (Size k=0; k<ivPayoffs.size(); ++k) {
+            if (impliedVols.impliedVolatility(k) != Null<Real>())
+                ivError = std::max(ivError, std::fabs(
+                    impliedVols.impliedVolatility(k) - ivTrue[k]));
+            rootError = std::max(rootError,
+                                 std::fabs(rootVols[k] - ivTrue[k]));
+            ivEvaluations += impliedVols.evaluations(k);
+        }
+        std::cout << "Implied volatilities (" << ivPayoffs.size()
+                  << " American puts, " << ivSteps << " steps)\n";
+        std::cout << "Batch solver: Max error: " << ivError
+                  << ", Trees: " << ivEvaluations
+                  << ", Time: " << elapsed_secondsBatch.count() << "s\n";
+        std::cout << "Root finder: Max error: " << rootError
+                  << ", Time: " << elapsed_secondsRoot.count() << "s\n";
+        std::cout << std::endl ;
+
+        // a book of options priced concurrently
+        Size bookSteps = 1000;
+        std::vector<boost::shared_ptr<VanillaOption> > book;
+        for (Integer months=3; months<=24; months+=3) {
+            boost::shared_ptr<Exercise> bookExercise(
+                new AmericanExercise(settlementDate,
+                                     calendar.advance(settlementDate,
+                                                      months, Months)));
+            for (Real k=80.0; k<=120.0; k+=5.0) {
+                book.push_back(boost::shared_ptr<VanillaOption>(
+                    new VanillaOption(
+                        boost::shared_ptr<StrikedTypePayoff>(
+                            new PlainVanillaPayoff(Option::Put, k)),
+                        bookExercise)));
+            }
+        }
+
+        auto starttimeBook = std::chrono::system_clock::now();
+        BinomialPortfolio_2<CoxRossRubinstein_2> portfolio(bookSteps, pool);
+        for (Size k=0; k<book.size(); ++k)
+            portfolio.add(book[k], bsmProcess);
+        portfolio.calculate();
+        auto endtimeBook = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsBook = endtimeBook-starttimeBook;
+
+        auto starttimeOneByOne = std::chrono::system_clock::now();
+        Real bookError = 0.0;
+        for (Size k=0; k<book.size(); ++k) {
+            book[k]->setPricingEngine(
+                MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                    .withSteps(bookSteps));
+            bookError = std::max(bookError,
+                                 std::fabs(book[k]->NPV() -
+                                           portfolio.value(k)));
+        }
+        auto endtimeOneByOne = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsOneByOne = endtimeOneByOne-starttimeOneByOne;
+
+        std::cout << "Book of " << book.size() << " American puts ("
+                  << bookSteps << " steps, " << pool->size()
+                  << " threads)\n";
+        std::cout << "Portfolio: Max difference: " << bookError
+                  << ", Time: " << elapsed_secondsBook.count() << "s\n";
+        std::cout << "One engine per option: Time: "
+                  << elapsed_secondsOneByOne.count() << "s\n";
+        std::cout << std::endl ;
+
+        // small trees priced directly from plain numbers
+        Size directSteps = 50, directRuns = 10000;
+        BinomialOptionInputs_2 inputs = {
+            underlying, strike, riskFreeRate, dividendYield, volatility,
+            maturityTime, Option::Put, Exercise::American, directSteps
+        };
+        Real workspace[2*(50 + 3 + detail::binomialPadding)];
+        QL_REQUIRE(binomialWorkspaceSize_2(directSteps) <=
+                       sizeof(workspace)/sizeof(Real),
+                   "workspace too small");
+        BinomialOptionResult_2 direct = { 0.0, 0.0, 0.0, 0.0 };
+        auto starttimeDirect = std::chrono::system_clock::now();
+        for (Size k=0; k<directRuns; ++k)
+            direct = binomialPrice_2<CoxRossRubinstein_2>(inputs, workspace);
+        auto endtimeDirect = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsDirect = endtimeDirect-starttimeDirect;
+
+        americanOption.setPricingEngine(
+            MakeBinomialVanillaEngine_2<CoxRossRubinstein_2>(bsmProcess)
+                .withSteps(directSteps));
+        Real engineValue = 0.0;
+        auto starttimeLayered = std::chrono::system_clock::now();
+        for (Size k=0; k<directRuns; ++k) {
+            americanOption.recalculate();
+            engineValue = americanOption.NPV();
+        }
+        auto endtimeLayered = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_secondsLayered = endtimeLayered-starttimeLayered;
+
+        std::cout << "Direct pricing (" << directSteps << " steps)\n";
+        std::cout << "binomialPrice_2: " << direct.value
+                  << ", Delta: " << direct.delta
+                  << ", Gamma: " << direct.gamma
+                  << ", Theta: " << direct.theta << ", Time: "
+                  << 1.0e6*elapsed_secondsDirect.count()/directRuns
+                  << "us\n";
+        std::cout << "Instrument and engine: " << engineValue << ", Time: "
+                  << 1.0e6*elapsed_secondsLayered.count()/directRuns
+                  << "us\n";
+        std::cout << std::endl ;
+
+        // latency percentiles on small trees
+        std::cout << "Latencies of American puts (CRR)\n";
+        fixedTreeLatencies<50>(inputs, 100000);
+        fixedTreeLatencies<100>(inputs, 100000);
+        fixedTreeLatencies<200>(inputs, 100000);
+        std::cout << std::endl ;
+
+
     
         
         
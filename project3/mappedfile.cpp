@@ -0,0 +1,81 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+#include "mappedfile.hpp"
+#include <ql/errors.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace QuantLib {
+
+    MappedFile_2::MappedFile_2(const std::string& path)
+    : fd_(::open(path.c_str(), O_RDONLY)), data_(0), size_(0) {
+        QL_REQUIRE(fd_ >= 0,
+                   "cannot open " << path << ": " << std::strerror(errno));
+        map(path, false);
+    }
+
+    MappedFile_2::MappedFile_2(const std::string& path, Size size)
+    : fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)),
+      data_(0), size_(0) {
+        QL_REQUIRE(fd_ >= 0,
+                   "cannot create " << path << ": " << std::strerror(errno));
+        if (::ftruncate(fd_, off_t(size)) != 0) {
+            int error = errno;
+            ::close(fd_);
+            QL_FAIL("cannot resize " << path << ": "
+                    << std::strerror(error));
+        }
+        map(path, true);
+    }
+
+    MappedFile_2::~MappedFile_2() {
+        if (data_)
+            ::munmap(data_, size_);
+        ::close(fd_);
+    }
+
+    void MappedFile_2::map(const std::string& path, bool writable) {
+        struct stat info;
+        int error = 0;
+        if (::fstat(fd_, &info) != 0) {
+            error = errno;
+        } else {
+            size_ = Size(info.st_size);
+            // empty files cannot be mapped, and need not be
+            if (size_ == 0)
+                return;
+            void* p = ::mmap(0, size_,
+                             writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                             MAP_SHARED, fd_, 0);
+            if (p != MAP_FAILED) {
+                data_ = static_cast<char*>(p);
+                if (!writable)
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                return;
+            }
+            error = errno;
+        }
+        ::close(fd_);
+        QL_FAIL("cannot map " << path << ": " << std::strerror(error));
+    }
+
+}
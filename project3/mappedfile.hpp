@@ -0,0 +1,57 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file mappedfile.hpp
+    \brief Memory mapping of files
+*/
+
+#ifndef mapped_file_2_hpp
+#define mapped_file_2_hpp
+
+#include <ql/types.hpp>
+#include <string>
+
+namespace QuantLib {
+
+    //! Memory mapping of a whole file
+    /*! POSIX only.  The mapping is released, and the file closed,
+        on destruction.
+    */
+    class MappedFile_2 {
+      public:
+        //! maps an existing file for reading
+        explicit MappedFile_2(const std::string& path);
+        //! creates a file of the given size, or truncates an
+        //! existing one to it, and maps it for writing
+        MappedFile_2(const std::string& path, Size size);
+        ~MappedFile_2();
+        Size size() const { return size_; }
+        const char* data() const { return data_; }
+        char* data() { return data_; }
+      private:
+        MappedFile_2(const MappedFile_2&);
+        MappedFile_2& operator=(const MappedFile_2&);
+        void map(const std::string& path, bool writable);
+        int fd_;
+        char* data_;
+        Size size_;
+    };
+
+}
+
+
+#endif
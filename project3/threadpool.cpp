@@ -0,0 +1,170 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+#include "threadpool.hpp"
+#include <ql/errors.hpp>
+#include <algorithm>
+
+namespace QuantLib {
+
+    ThreadPool_2::ThreadPool_2(Size threads)
+    : job_(0), participants_(0), pending_(0), generation_(0), stop_(false) {
+        QL_REQUIRE(threads > 0, "at least one thread required");
+        for (Size k=1; k<threads; ++k)
+            workers_.push_back(std::thread(&ThreadPool_2::work, this, k));
+    }
+
+    ThreadPool_2::~ThreadPool_2() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (Size k=0; k<workers_.size(); ++k)
+            workers_[k].join();
+    }
+
+    Size ThreadPool_2::defaultSize() {
+        Size n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    void ThreadPool_2::run(Size n, const std::function<void(Size)>& f) {
+        QL_REQUIRE(n > 0 && n <= size(),
+                   n << " threads requested, " << size() << " available");
+        std::lock_guard<std::mutex> runLock(runMutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &f;
+            participants_ = n;
+            pending_ = n-1;
+            error_ = std::exception_ptr();
+            ++generation_;
+        }
+        start_.notify_all();
+
+        std::exception_ptr error;
+        try {
+            f(0);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return pending_ == 0; });
+        job_ = 0;
+        if (!error)
+            error = error_;
+        lock.unlock();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void ThreadPool_2::forEach(Size n,
+                               const std::function<void(Size, Size)>& f) {
+        if (n == 0)
+            return;
+        Size threads = std::min(size(), n);
+
+        struct Range {
+            std::mutex mutex;
+            Size begin, end;
+        };
+        std::vector<Range> ranges(threads);
+        for (Size p=0; p<threads; ++p) {
+            ranges[p].begin = p*n/threads;
+            ranges[p].end = (p+1)*n/threads;
+        }
+
+        run(threads, [&](Size p) {
+            Range& own = ranges[p];
+            for (;;) {
+                Size item = n;
+                {
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if (own.begin < own.end)
+                        item = own.begin++;
+                }
+                if (item == n) {
+                    // steal the back half of the largest range left
+                    Size victim = threads, largest = 0;
+                    for (Size q=0; q<threads; ++q) {
+                        if (q == p)
+                            continue;
+                        std::lock_guard<std::mutex> lock(ranges[q].mutex);
+                        Size left = ranges[q].end - ranges[q].begin;
+                        if (left > largest) {
+                            largest = left;
+                            victim = q;
+                        }
+                    }
+                    if (victim == threads)
+                        return;
+                    Size begin, end;
+                    {
+                        std::lock_guard<std::mutex> lock(
+                                                   ranges[victim].mutex);
+                        Range& r = ranges[victim];
+                        if (r.begin == r.end)
+                            continue;
+                        begin = r.begin + (r.end - r.begin)/2;
+                        end = r.end;
+                        r.end = begin;
+                    }
+                    item = begin;
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    own.begin = begin+1;
+                    own.end = end;
+                }
+                f(p, item);
+            }
+        });
+    }
+
+    void ThreadPool_2::work(Size index) {
+        Size seen = 0;
+        for (;;) {
+            const std::function<void(Size)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&]() {
+                    return stop_ || generation_ != seen;
+                });
+                if (stop_)
+                    return;
+                seen = generation_;
+                if (index >= participants_)
+                    continue;
+                job = job_;
+            }
+            std::exception_ptr error;
+            try {
+                (*job)(index);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (error && !error_)
+                    error_ = error;
+                if (--pending_ == 0)
+                    done_.notify_one();
+            }
+        }
+    }
+
+}
@@ -0,0 +1,109 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ This file is part of QuantLib, a free-software/open-source library
+ for financial quantitative analysts and developers - http://quantlib.org/
+
+ QuantLib is free software: you can redistribute it and/or modify it
+ under the terms of the QuantLib license.  You should have received a
+ copy of the license along with this program; if not, please email
+ <quantlib-dev@lists.sf.net>. The license is also available online at
+ <http://quantlib.org/license.shtml>.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE.  See the license for more details.
+*/
+
+/*! \file threadpool.hpp
+    \brief Fixed-size pool of worker threads
+*/
+
+#ifndef thread_pool_2_hpp
+#define thread_pool_2_hpp
+
+#include <ql/types.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Fixed-size pool of worker threads
+    /*! run() executes a function on several threads at once, the
+        calling one included, and returns when all of them are done.
+        All participants are running at the same time, so they can
+        synchronize with a SpinBarrier_2.
+
+        Calls to run() from different threads are serialized; they
+        must not be nested.
+    */
+    class ThreadPool_2 {
+      public:
+        //! \c threads includes the calling thread
+        explicit ThreadPool_2(Size threads = defaultSize());
+        ~ThreadPool_2();
+        //! number of threads available to run(), the caller included
+        Size size() const { return workers_.size() + 1; }
+        //! runs f(0), ..., f(n-1) concurrently and waits for them
+        /*! f(0) runs on the calling thread.  The first exception
+            thrown by any of the calls is rethrown here.
+        */
+        void run(Size n, const std::function<void(Size)>& f);
+        //! runs f(p, k) for k = 0, ..., n-1 on all threads, with work stealing
+        /*! p is the index of the thread running item k, so that
+            each thread can work on its own state.  The items are
+            split in one contiguous range per thread; each thread
+            takes items from the front of its own range and, once it
+            runs out, steals the back half of the largest range left.
+            Items of uneven cost are thus balanced without a shared
+            counter being hit for every item.  The first exception
+            thrown is rethrown here, as for run().
+        */
+        void forEach(Size n, const std::function<void(Size, Size)>& f);
+        //! hardware concurrency, or 1 if it cannot be detected
+        static Size defaultSize();
+      private:
+        void work(Size index);
+        std::vector<std::thread> workers_;
+        std::mutex runMutex_, mutex_;
+        std::condition_variable start_, done_;
+        const std::function<void(Size)>* job_;
+        Size participants_, pending_, generation_;
+        bool stop_;
+        std::exception_ptr error_;
+    };
+
+
+    //! Reusable barrier for a fixed number of threads
+    /*! Waiting threads spin (yielding) instead of sleeping, which
+        keeps the latency low when the work between two barriers is
+        short.
+    */
+    class SpinBarrier_2 {
+      public:
+        explicit SpinBarrier_2(Size n) : n_(n), count_(0), generation_(0) {}
+        void wait() {
+            Size generation = generation_.load(std::memory_order_acquire);
+            if (count_.fetch_add(1, std::memory_order_acq_rel) + 1 == n_) {
+                count_.store(0, std::memory_order_relaxed);
+                generation_.fetch_add(1, std::memory_order_release);
+            } else {
+                while (generation_.load(std::memory_order_acquire)
+                       == generation)
+                    std::this_thread::yield();
+            }
+        }
+      private:
+        Size n_;
+        std::atomic<Size> count_, generation_;
+    };
+
+}
+
+
+#endif